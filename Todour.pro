@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui network widgets
+QT       += core gui network widgets concurrent
 
 TARGET = Todour
 TEMPLATE = app
@@ -29,7 +29,15 @@ SOURCES += main.cpp\
     todotablemodel.cpp \
     settingsdialog.cpp \
     aboutbox.cpp \
-    quickadddialog.cpp
+    quickadddialog.cpp \
+    todosettings.cpp \
+    todofiltermodel.cpp \
+    todorowheights.cpp \
+    todoitemdelegate.cpp \
+    linescanner.cpp \
+    linearena.cpp \
+    postinglists.cpp \
+    todofilewatcher.cpp
 
 HEADERS  += mainwindow.h \
     todotxt.h \
@@ -38,7 +46,15 @@ HEADERS  += mainwindow.h \
     aboutbox.h \
     globals.h \
     quickadddialog.h \
-    def.h
+    def.h \
+    todosettings.h \
+    todofiltermodel.h \
+    todorowheights.h \
+    todoitemdelegate.h \
+    linescanner.h \
+    linearena.h \
+    postinglists.h \
+    todofilewatcher.h
 
 FORMS    += mainwindow.ui \
     settingsdialog.ui \
@@ -29,6 +29,8 @@
 #define DEFAULT_PRIO_ON_CLOSE 0
 #define DEFAULT_REMOVE_DOUBLETS false
 #define DEFAULT_UUID "0000-0000-0000-0000"
+#define DEFAULT_UNDO_BUDGET 4096 // kB of memory the undo journal may use
+#define DEFAULT_TRIGRAM_INDEX true
 
 
 // Names of settings in QSettings
@@ -71,6 +73,8 @@
 #define SETTINGS_FONT_SIZE "font_size"
 #define SETTINGS_REMOVE_DOUBLETS "remove_doublets"
 #define SETTINGS_UUID "uuid"
+#define SETTINGS_UNDO_BUDGET "undo_budget"
+#define SETTINGS_TRIGRAM_INDEX "trigram_index"
 
 enum prio_on_close {removeit=0,moveit,tagit};
 
@@ -0,0 +1,73 @@
+#include "linearena.h"
+
+void lineArena::clear()
+{
+    file.reset(); // Which unmaps it
+    mapped = nullptr;
+    mappedSize = 0;
+    data.clear();
+    lines.clear();
+}
+
+void lineArena::assign(const QByteArray &bytes, std::vector<scannedLine> &lines)
+{
+    clear();
+    data = bytes;
+    this->lines.swap(lines);
+}
+
+void lineArena::assign(std::unique_ptr<QFile> &file, const char *mapped, qint64 size, std::vector<scannedLine> &lines)
+{
+    clear();
+    this->file.swap(file);
+    this->mapped = mapped;
+    mappedSize = size;
+    this->lines.swap(lines);
+}
+
+void lineArena::append(const QString &line)
+{
+    QByteArray utf8 = line.toUtf8();
+    bool ascii = true;
+    for (char c : utf8)
+    {
+        if ((c & 0x80) || c == '\r')
+        {
+            ascii = false;
+            break;
+        }
+    }
+    lines.push_back({mappedSize + data.size(), utf8.size(), ascii});
+    data.append(utf8);
+}
+
+int lineArena::size() const
+{
+    return (int)lines.size();
+}
+
+QString lineArena::at(int i) const
+{
+    const scannedLine &l = lines[i];
+    const char *bytes;
+    if (l.start < mappedSize)
+    {
+        // Reading a mapped page that the file no longer has crashes. Someone cutting the file short is
+        // seen by the watcher, which has it read again, so until then the line is just empty
+        if (file->size() < mappedSize)
+            return QString();
+        bytes = mapped + l.start;
+    }
+    else
+    {
+        bytes = data.constData() + (l.start - mappedSize);
+    }
+
+    if (l.ascii)
+        return QString::fromLatin1(bytes, l.length);
+
+    // The same as the file reader does for lines that aren't plain ASCII
+    QString line = QString::fromUtf8(bytes, l.length);
+    line.remove('\r');
+    return line;
+}
@@ -0,0 +1,36 @@
+/* Lines kept as UTF-8 in one block of memory.
+  A QString per line costs two bytes per character plus an allocation, which for a large done.txt
+  adds up to several times the size of the file. This keeps the bytes of the file as they were read,
+  or the file itself mapped into memory, together with where each line starts, and makes a QString
+  only when a line is asked for.
+  */
+
+#ifndef LINEARENA_H
+#define LINEARENA_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <memory>
+#include <vector>
+#include "linescanner.h"
+
+class lineArena
+{
+public:
+    void clear();
+    void assign(const QByteArray &bytes, std::vector<scannedLine> &lines); // Takes over the bytes of a file and where its lines are
+    void assign(std::unique_ptr<QFile> &file, const char *mapped, qint64 size, std::vector<scannedLine> &lines); // The same for a file that is mapped. It is kept open until cleared
+    void append(const QString &line);
+    int size() const;
+    QString at(int i) const; // Decoded every time, so keep what is used often
+
+protected:
+    std::unique_ptr<QFile> file; // The mapped file
+    const char *mapped = nullptr;
+    qint64 mappedSize = 0;
+    QByteArray data;             // The bytes that were read, or the lines appended after the mapped ones, which start at mappedSize
+    std::vector<scannedLine> lines;
+};
+
+#endif // LINEARENA_H
@@ -0,0 +1,95 @@
+#include "linescanner.h"
+#include <QtAlgorithms>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCAN_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCAN_SSE2
+#endif
+
+namespace
+{
+    // Ends a line at each newline that is found
+    struct lineCollector
+    {
+        const char *data;
+        std::vector<scannedLine> &lines;
+        qint64 start;
+        bool ascii;
+
+        void end(qint64 newline)
+        {
+            qint64 e = newline;
+            if (e > start && data[e - 1] == '\r')
+                e--;
+            // A \r anywhere else is rare enough to look for here rather than in the scan
+            bool plain = ascii && memchr(data + start, '\r', (size_t)(e - start)) == NULL;
+            lines.push_back({start, (int)(e - start), plain});
+            start = newline + 1;
+            ascii = true;
+        }
+    };
+
+#if defined(SCAN_AVX2) || defined(SCAN_SSE2)
+    // A block of bytes at pos, with a bit set for each newline and for each byte that isn't ASCII
+    void scanBlock(lineCollector &c, qint64 pos, quint32 newlines, quint32 high)
+    {
+        while (newlines)
+        {
+            int bit = (int)qCountTrailingZeroBits(newlines);
+            quint32 upTo = 0xffffffffu >> (31 - bit); // The bytes up to and including the newline
+            if (high & upTo)
+                c.ascii = false;
+            c.end(pos + bit);
+            high &= ~upTo;
+            newlines &= newlines - 1;
+        }
+        if (high)
+            c.ascii = false;
+    }
+#endif
+}
+
+void scanLines(const char *data, qint64 size, std::vector<scannedLine> &lines)
+{
+    lineCollector c{data, lines, 0, true};
+    qint64 i = 0;
+
+#if defined(SCAN_AVX2)
+    const __m256i newline = _mm256_set1_epi8('\n');
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        quint32 newlines = (quint32)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        quint32 high = (quint32)_mm256_movemask_epi8(v);
+        if (newlines | high)
+            scanBlock(c, i, newlines, high);
+    }
+#elif defined(SCAN_SSE2)
+    const __m128i newline = _mm_set1_epi8('\n');
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+        quint32 newlines = (quint32)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        quint32 high = (quint32)_mm_movemask_epi8(v);
+        if (newlines | high)
+            scanBlock(c, i, newlines, high);
+    }
+#endif
+
+    // What is left after the blocks, or everything without SIMD
+    for (; i < size; i++)
+    {
+        unsigned char b = (unsigned char)data[i];
+        if (b == '\n')
+            c.end(i);
+        else if (b & 0x80)
+            c.ascii = false;
+    }
+
+    if (c.start < size)
+        c.end(size);
+}
@@ -0,0 +1,23 @@
+/* Finds the lines of a file that is in memory, like one mapped with QFile::map().
+  The newlines are looked for many bytes at a time with SSE2 or AVX2 when the compiler targets
+  them, and one byte at a time otherwise. The same pass notes which lines are plain ASCII, so
+  that those can be turned into QStrings without UTF-8 decoding.
+  */
+
+#ifndef LINESCANNER_H
+#define LINESCANNER_H
+
+#include <QtGlobal>
+#include <vector>
+
+struct scannedLine
+{
+    qint64 start; // Offset of the first byte
+    int length;   // Without the \n, and without a \r before it
+    bool ascii;   // Only ASCII and no \r, so the bytes can be taken as Latin-1 as they are
+};
+
+// Adds the lines of data to lines. A last line without a newline is included if it isn't empty
+void scanLines(const char *data, qint64 size, std::vector<scannedLine> &lines);
+
+#endif // LINESCANNER_H
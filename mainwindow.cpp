@@ -1,6 +1,6 @@
 #include <map>
+#include <set>
 #include <iostream>
-#include <sstream>
 #include <vector>
 
 #include "mainwindow.h"
@@ -14,10 +14,13 @@
 #include "aboutbox.h"
 #include "globals.h"
 #include "def.h"
+#include "todosettings.h"
+#include "todofiltermodel.h"
+#include "todorowheights.h"
+#include "todoitemdelegate.h"
+#include "todofilewatcher.h"
 
 #include <QSortFilterProxyModel>
-#include <QFileSystemWatcher>
-#include <QTime>
 #include <QDebug>
 #include <QSettings>
 #include <QShortcut>
@@ -75,6 +78,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent),
         QSettings::setPath(QSettings::IniFormat, QSettings::UserScope, QDir::currentPath());
         qDebug() << "Setting ini file path to: " << QDir::currentPath() << Qt::endl;
     }
+    TodoSettings::reload(); // Make sure the snapshot is read from the right place
 
     hotkey = new UGlobalHotkeys();
     setHotkey();
@@ -131,6 +135,7 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent),
     if (!settings.contains(SETTINGS_LIVE_SEARCH))
     {
         settings.setValue(SETTINGS_LIVE_SEARCH, DEFAULT_LIVE_SEARCH);
+        TodoSettings::reload();
     }
 
     // Started. Lets open the todo.txt file, parse it and show it.
@@ -251,15 +256,9 @@ MainWindow::MainWindow(QWidget *parent) : QMainWindow(parent),
 
     //auto contextshortcut = new QShortcut(QKeySequence(tr("Ctrl+l")),this);
     //QObject::connect(contextshortcut,SIGNAL(activated()),ui->context_lock,SLOT(setChecked(!(ui->context_lock->isChecked()))));
-    QObject::connect(model, SIGNAL(dataChanged(const QModelIndex, const QModelIndex)), this, SLOT(dataInModelChanged(QModelIndex, QModelIndex)));
+    QObject::connect(model, SIGNAL(edited(QModelIndex, QModelIndex)), this, SLOT(dataInModelChanged(QModelIndex, QModelIndex)));
 
-    // Resize tableView row height on first load, and then again when resizing window
-    QTimer::singleShot(1, ui->tableView, SLOT(resizeRowsToContents()));
-    connect(
-        ui->tableView->horizontalHeader(),
-        SIGNAL(sectionResized(int, int, int)),
-        ui->tableView,
-        SLOT(resizeRowsToContents()));
+    // The row heights follow the window size. Only the rows on screen are measured, see TodoRowHeights
 
     /*
     These should now be handled in the menu system
@@ -313,14 +312,9 @@ void MainWindow::dataInModelChanged(QModelIndex i1, QModelIndex i2)
     //qDebug()<<"Data in Model changed emitted:"<<i1.data(Qt::UserRole)<<"::"<<i2.data(Qt::UserRole)<<endl;
     //qDebug()<<"Changed:R="<<i1.row()<<":C="<<i1.column()<<endl;
     saved_selection = i1.data(Qt::UserRole).toString();
-    QSettings settings;
-    if (settings.value(SETTINGS_AUTOREFRESH).toBool() == false)
-    {
-        // Reselect the previously selected line
-        // Avoid with autorefresh, since that will also attempt this after the file reloads
-        // TODO: settings seem cached, the app has to restart for this to apply if the user toggles the setting.
-        resetTableSelection();
-    }
+    // Reselect the previously selected line
+    // Our own writes don't cause a reload from the file watcher anymore, so this has to be done here even with autorefresh
+    resetTableSelection();
     updateTitle();
 }
 
@@ -334,9 +328,10 @@ MainWindow::~MainWindow()
 }
 
 // proxyModel is a filtered view of the UI model
-QSortFilterProxyModel *proxyModel = NULL;
+TodoFilterModel *proxyModel = NULL;
+TodoRowHeights *rowHeights = NULL;
 
-QFileSystemWatcher *watcher;
+TodoFileWatcher *watcher = NULL;
 
 void MainWindow::updateTitle()
 {
@@ -355,76 +350,55 @@ void MainWindow::updateTitle()
     ui->actionRedo->setEnabled(model->redoPossible());
 }
 
-// A simple delay function I pulled of the 'net.. Need to delay reading a file a little bit.. A second seems to be enough
-// really don't like this though as I have no idea of knowing when a second is enough.
-// Having more than one second will impact usability of the application as it changes the focus.
-void delay()
+void MainWindow::filesChanged()
 {
-    QTime dieTime = QTime::currentTime().addSecs(1);
-    while (QTime::currentTime() < dieTime)
-        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
-}
-
-void MainWindow::fileModified(const QString &str)
-{
-    Q_UNUSED(str);
-    //qDebug()<<"MainWindow::fileModified  "<<watcher->files()<<" --- "<<str;
-    saveTableSelection();
-    model->refresh();
-    if (model->count() == 0)
+    // The watcher has waited until the files were completely written
+    if (!model->changedOnDisk())
     {
-        // This sometimes happens when the file is being updated. We have gotten the signal a bit soon so the file is still empty. Wait and try again
-        delay();
-        model->refresh();
-        updateTitle();
+        // This was our own write, or someone wrote back the same lines. The model already has what is in the files
+        return;
     }
+    saveTableSelection();
+    model->refresh();
+    updateTitle();
     resetTableSelection();
-    setFileWatch();
 }
 
-void MainWindow::clearFileWatch()
+void MainWindow::setFileWatch()
 {
-    if (watcher != NULL)
+    if (watcher == NULL)
     {
-        delete watcher;
-        watcher = NULL;
+        watcher = new TodoFileWatcher(this);
+        QObject::connect(watcher, SIGNAL(changed()), this, SLOT(filesChanged()));
     }
-}
 
-void MainWindow::setFileWatch()
-{
-    QSettings settings;
-    if (settings.value(SETTINGS_AUTOREFRESH).toBool() == false)
+    if (!TodoSettings::current().autorefresh)
+    {
+        watcher->clear();
         return;
-
-    clearFileWatch();
-
-    watcher = new QFileSystemWatcher();
-    //qDebug()<<"Mainwindow::setFileWatch :: "<<watcher->files();
-    watcher->removePaths(watcher->files()); // Make sure this is empty. Should only be this file we're using in this program, and only one instance
-    watcher->addPath(model->getTodoFile());
-    QObject::connect(watcher, SIGNAL(fileChanged(QString)), this, SLOT(fileModified(QString)));
+    }
+    watcher->setFiles(QStringList() << model->getTodoFile() << model->getDoneFile());
 }
 
 void MainWindow::parse_todotxt()
 {
 
     model = new TodoTableModel(this);
-    proxyModel = new QSortFilterProxyModel(this);
+    proxyModel = new TodoFilterModel(this);
     proxyModel->setSourceModel(model);
-    proxyModel->setFilterCaseSensitivity(Qt::CaseInsensitive);
+    connect(proxyModel, &TodoFilterModel::resultsReady, this, &MainWindow::updateActiveTags);
     ui->tableView->setModel(proxyModel);
     //ui->tableView->resizeColumnsToContents();
     //ui->tableView->horizontalHeader()->setResizeMode(QHeaderView::Stretch);
     ui->tableView->horizontalHeader()->setSectionResizeMode(1, QHeaderView::Stretch);
     ui->tableView->resizeColumnToContents(0); // Checkboxes kept small
     ui->tableView->setWordWrap(true);
+    ui->tableView->setItemDelegateForColumn(1, new TodoItemDelegate(ui->tableView));
+    rowHeights = new TodoRowHeights(ui->tableView);
+    rowHeights->setModel(proxyModel);
 
     listModel = new QStringListModel(this);
     ui->lv_activetags->setModel(listModel);
-    int row = listModel->rowCount();
-
-    listModel->insertRows(row, 1000);
     // listModel->setData(listModel->index(0), "(A)");
     // listModel->setData(listModel->index(1), "(B)");
     // listModel->setData(listModel->index(2), "(C)");
@@ -445,9 +419,7 @@ void MainWindow::parse_todotxt()
 void MainWindow::on_lineEdit_2_textEdited(const QString &arg1)
 {
     Q_UNUSED(arg1);
-    QSettings settings;
-
-    bool liveUpdate = settings.value(SETTINGS_LIVE_SEARCH).toBool();
+    bool liveUpdate = TodoSettings::current().liveSearch;
     if (!ui->cb_showaall->checkState() && liveUpdate)
     {
         updateSearchResults();
@@ -457,9 +429,7 @@ void MainWindow::on_lineEdit_2_textEdited(const QString &arg1)
 void MainWindow::on_lineEdit_3_textEdited(const QString &arg1)
 {
     Q_UNUSED(arg1);
-    QSettings settings;
-
-    bool liveUpdate = settings.value(SETTINGS_LIVE_SEARCH).toBool();
+    bool liveUpdate = TodoSettings::current().liveSearch;
     if (!ui->cb_showaall->checkState() && liveUpdate)
     {
         updateSearchResults();
@@ -468,51 +438,21 @@ void MainWindow::on_lineEdit_3_textEdited(const QString &arg1)
 
 QString get_second(pair<QString, int> i) { return i.first + " (" + QString::number(i.second, 'f', 0) + ")"; }
 
-bool compareInterval(QString i1, QString i2)
+// An entry in the tag list. The sort key is worked out once per tag instead of with regexes in every comparison
+struct tagEntry
 {
-    QRegularExpression projectRegex("^[+][a-zA-Z]");
-    QRegularExpressionMatch m_i1project = projectRegex.match(i1);
-    QRegularExpressionMatch m_i2project = projectRegex.match(i2);
-
-    QRegularExpression contextRegex("^[@]");
-    QRegularExpressionMatch m_i1context = contextRegex.match(i1);
-    QRegularExpressionMatch m_i2context = contextRegex.match(i2);
-
-    // Sort projects to top of list
-    if (m_i1project.hasMatch() && !m_i2project.hasMatch())
-    {
-        return true;
-    }
-    else if (!m_i1project.hasMatch() && m_i2project.hasMatch())
-    {
-        return false;
-    }
-
-    // Sort contexts after projects
-    // Then sort by standard words
-    if (m_i1context.hasMatch() && !m_i2context.hasMatch())
-    {
-        return true;
-    }
-    else if (!m_i1context.hasMatch() && m_i2context.hasMatch())
-    {
-        return false;
-    }
-
-    QRegularExpression priorityRegex("[(]([0-9]+)[)]$");
-    QRegularExpressionMatch m_i1 = priorityRegex.match(i1);
-    QRegularExpressionMatch m_i2 = priorityRegex.match(i2);
-
-    string s1 = m_i1.captured(1).toUtf8().constData();
-    string s2 = m_i2.captured(1).toUtf8().constData();
-    stringstream c1(s1);
-    stringstream c2(s2);
-    int x1 = 0;
-    int x2 = 0;
-    c1 >> x1;
-    c2 >> x2;
+    int group; // Projects first, then contexts, then anything else
+    int count;
+    QString text;
+};
 
-    return (x1 > x2);
+bool compareInterval(const tagEntry &i1, const tagEntry &i2)
+{
+    if (i1.group != i2.group)
+        return i1.group < i2.group;
+    if (i1.count != i2.count)
+        return i1.count > i2.count; // Most used first
+    return i1.text < i2.text;
 }
 
 /* template <class InputIt, class OutputIt, class Pred, class Fct> */
@@ -531,96 +471,56 @@ vector<QString> stopwords(stopwordsArr, stopwordsArr + sizeof(stopwordsArr) / si
 
 void MainWindow::updateSearchResults()
 {
-    // Take the text of the format of match1 match2 !match3 and turn it into
-    //(?=.*match1)(?=.*match2)(?!.*match3) - all escaped of course
+    // The text of the format match1 +tag !match3 is compiled into a query that the proxy model runs on the task records.
+    // The search runs in the background. The title and the tag list are updated in updateActiveTags() when it is done
     QString fullPhrase = ui->lineEdit_3->text() + " " + ui->lineEdit_2->text();
-    QStringList words = fullPhrase.simplified().split(QRegularExpression("\\s+"));
-    QString regexpstring = "(?=^.*$)"; // Seems a negative lookahead can't be first (!?), so this is a workaround
-    for (QString word : words)
-    {
-        QString start = "(?=^.*";
-        if (word.length() > 0 && word.at(0) == '!')
-        {
-            start = "(?!^.*";
-            word = word.remove(0, 1);
-        }
-        if (word.length() == 0)
-            break;
-        regexpstring += start + QRegExp::escape(word) + ".*$)";
-    }
-    QRegExp regexp(regexpstring, Qt::CaseInsensitive);
-    proxyModel->setFilterRegExp(regexp);
-    //qDebug()<<"Setting filter: "<<regexp.pattern();
-    proxyModel->setFilterKeyColumn(1);
+    proxyModel->setQuery(fullPhrase);
+}
+
+void MainWindow::updateActiveTags(const std::map<QString, int> &tags)
+{
     updateTitle();
 
-    int rowCount = listModel->rowCount();
-    for (int i = 0; i < rowCount; ++i)
+    // The tags of the rows that are shown are counted by the search, so only those not searched for are left to pick out here
+    vector<tagEntry> entries;
+    entries.reserve(tags.size());
+    for (auto &tag : tags)
     {
-        listModel->setData(listModel->index(i), "");
-    }
-
-    std::map<QString, int> contexts = {};
+        const QString &name = tag.first;
+        if (ui->lineEdit_2->text().indexOf(name) != -1 || ui->lineEdit_3->text().indexOf(name) != -1)
+            continue;
+        if (std::find(stopwords.begin(), stopwords.end(), name) != stopwords.end())
+            continue;
 
-    // for (int i = 0; i < ui->tableView->model()->rowCount() && i < 100; ++i)
-    for (int i = 0; i < ui->tableView->model()->rowCount(); ++i)
-    {
-        auto index = ui->tableView->model()->index(i, 1);
-        QString rowText = ui->tableView->model()->data(index, Qt::UserRole).toString();
-        // QRegularExpression contextsRegex("([@][a-zA-Z0-9]+)");
-        // QRegularExpression contextsRegex("[ ([]([+@a-zA-Z][@a-zA-Z0-9-:/.]+)");
-        QRegularExpression contextsRegex("[ ([]([+@][@a-zA-Z0-9-:/.]+)");
-
-        QRegularExpressionMatchIterator j = contextsRegex.globalMatch(rowText);
-        while (j.hasNext())
-        {
-            QRegularExpressionMatch match = j.next();
-            if (match.hasMatch())
-            {
-                QString context = match.captured(1);
-                if (
-                    ui->lineEdit_2->text().indexOf(context) == -1 && ui->lineEdit_3->text().indexOf(context) == -1)
-                {
-                    contexts[QString(context)]++;
-                }
-            }
-        }
+        tagEntry e;
+        if (name.length() > 1 && name.at(0) == '+' && name.at(1).isLetter())
+            e.group = 0;
+        else if (name.startsWith('@'))
+            e.group = 1;
+        else
+            e.group = 2;
+        e.count = tag.second;
+        e.text = name + " (" + QString::number(tag.second) + ")";
+        entries.push_back(e);
     }
 
-    vector<QString> v(contexts.size());
+    sort(entries.begin(), entries.end(), compareInterval);
 
-    for (std::pair<const QString, int> &x : contexts)
-    {
-        if (std::find(stopwords.begin(), stopwords.end(), x.first) == stopwords.end())
-        {
-            v.push_back(x.first + " (" + QString::number(x.second, 'f', 0) + ")");
-        }
-    }
+    QStringList v;
+    v << "(A)" << "(B)" << "(C)" << "(D)" << "(E)" << "(F)";
+    v << "@today" << "@tonight" << "@work" << "@home";
+    v << "due:" << "rec:";
+    v << "-----------";
+    for (auto &e : entries)
+        v << e.text;
 
-    sort(v.begin(), v.end(), compareInterval);
-
-    v.insert(v.begin(), "-----------");
-    v.insert(v.begin(), "rec:");
-    v.insert(v.begin(), "due:");
-    v.insert(v.begin(), "@home");
-    v.insert(v.begin(), "@work");
-    v.insert(v.begin(), "@tonight");
-    v.insert(v.begin(), "@today");
-    v.insert(v.begin(), "(F)");
-    v.insert(v.begin(), "(E)");
-    v.insert(v.begin(), "(D)");
-    v.insert(v.begin(), "(C)");
-    v.insert(v.begin(), "(B)");
-    v.insert(v.begin(), "(A)");
-
-    for (int i = 0; i < v.size(); i++)
-    {
-        listModel->setData(listModel->index(i), v[i]);
-    }
+    // Sized to what there is to show
+    listModel->setStringList(v);
 }
 
 void MainWindow::focusTodoList()
 {
+    proxyModel->waitForResults(); // So that we select the first row of what was searched for
     auto index = ui->tableView->model()->index(0, 1);
     saved_selection = ui->tableView->model()->data(index, Qt::UserRole).toString();
     ui->tableView->selectionModel()->select(index, QItemSelectionModel::Select);
@@ -697,6 +597,7 @@ void MainWindow::on_actionSettings_triggered()
     {
         delete model;
         model = new TodoTableModel(this);
+        QObject::connect(model, SIGNAL(edited(QModelIndex, QModelIndex)), this, SLOT(dataInModelChanged(QModelIndex, QModelIndex)));
         proxyModel->setSourceModel(model);
         ui->tableView->setModel(proxyModel);
         ui->tableView->horizontalHeader()->setSectionResizeMode(1, QHeaderView::Stretch);
@@ -858,11 +759,10 @@ void MainWindow::deleteSelected()
         {
             QString t = model->data(proxyModel->mapToSource(index), Qt::UserRole).toString(); // User Role is Raw data
             //QString t=proxyModel->data(i).toString();
-            model->remove(t, false);
+            model->remove(t);
         },
         [=]()
         {
-            model->endReset();
             ui->tableView->setCurrentIndex(ui->tableView->model()->index(saved_row, saved_column));
             ui->tableView->setFocus(Qt::OtherFocusReason);
         });
@@ -991,6 +891,7 @@ void MainWindow::on_btn_Alphabetical_toggled(bool checked)
 {
     QSettings settings;
     settings.setValue(SETTINGS_SORT_ALPHA, checked);
+    TodoSettings::reload();
     on_pushButton_4_clicked(); // Refresh
 }
 
@@ -1004,6 +905,7 @@ void MainWindow::on_cb_showaall_stateChanged(int arg1)
 {
     QSettings settings;
     settings.setValue(SETTINGS_SHOW_ALL, arg1);
+    TodoSettings::reload();
     on_pushButton_4_clicked();
 }
 
@@ -1011,6 +913,7 @@ void MainWindow::on_cb_threshold_inactive_stateChanged(int arg1)
 {
     QSettings settings;
     settings.setValue(SETTINGS_THRESHOLD_INACTIVE, arg1);
+    TodoSettings::reload();
     on_pushButton_4_clicked();
 }
 
@@ -1058,18 +961,17 @@ void MainWindow::requestReceived(QNetworkReply *reply)
 
 void MainWindow::undo()
 {
-    if (model->undo())
-    {
-        model->refresh();
-    }
+    // The model is updated from the undo journal. No need to read the files again
+    saveTableSelection();
+    model->undo();
+    resetTableSelection();
 }
 
 void MainWindow::redo()
 {
-    if (model->redo())
-    {
-        model->refresh();
-    }
+    saveTableSelection();
+    model->redo();
+    resetTableSelection();
 }
 
 void MainWindow::clearSearch()
@@ -1105,11 +1007,10 @@ void MainWindow::completeTasks()
     forEachSelection([=](QModelIndex index, QString data)
                      {
                          auto checkbox = ui->tableView->model()->index(index.row(), 0);
-                         model->toggleRow(proxyModel->mapToSource(checkbox), false);
+                         model->toggleRow(proxyModel->mapToSource(checkbox));
                      },
                      [=]()
                      {
-                         model->endReset();
                          ui->tableView->setCurrentIndex(ui->tableView->model()->index(saved_row, saved_column));
                          ui->tableView->setFocus(Qt::OtherFocusReason);
                      });
@@ -1183,11 +1084,10 @@ void MainWindow::toggleToday()
                              data.append(" ");
                              data.append(text);
                          }
-                         model->setData(proxyModel->mapToSource(index), data.simplified(), Qt::EditRole, false);
+                         model->setData(proxyModel->mapToSource(index), data.simplified(), Qt::EditRole);
                      },
                      [=]()
                      {
-                         model->endReset();
                          ui->tableView->setCurrentIndex(ui->tableView->model()->index(saved_row, saved_column));
                          ui->tableView->setFocus(Qt::OtherFocusReason);
                      });
@@ -1211,10 +1111,9 @@ void MainWindow::showAppendDialog()
                          {
                              data.append(" ");
                              data.append(text);
-                             model->setData(proxyModel->mapToSource(index), data.simplified(), Qt::EditRole, false);
+                             model->setData(proxyModel->mapToSource(index), data.simplified(), Qt::EditRole);
                          },
-                         [=]()
-                         { model->endReset(); });
+                         [=]() {});
     }
 }
 
@@ -1235,10 +1134,9 @@ void MainWindow::showRemovalDialog()
         forEachSelection([=](QModelIndex index, QString data)
                          {
                              data.replace(text, "");
-                             model->setData(proxyModel->mapToSource(index), data.simplified(), Qt::EditRole, false);
+                             model->setData(proxyModel->mapToSource(index), data.simplified(), Qt::EditRole);
                          },
-                         [=]()
-                         { model->endReset(); });
+                         [=]() {});
     }
 }
 
@@ -1289,10 +1187,9 @@ void MainWindow::setThresholdForSelected(QString threshold)
                              data.append(threshold);
                          }
 
-                         model->setData(proxyModel->mapToSource(index), data, Qt::EditRole, false);
+                         model->setData(proxyModel->mapToSource(index), data, Qt::EditRole);
                      },
-                     [=]()
-                     { model->endReset(); });
+                     [=]() {});
 }
 
 void MainWindow::showDateDialog(QString typeName, QString prefix, QString dateRegexString)
@@ -1345,12 +1242,11 @@ void MainWindow::increasePriority()
                                  data = data.replace("(" + m.captured(1) + ")", "(" + (QString(newValue)) + ")");
                              }
 
-                             model->setData(proxyModel->mapToSource(index), data, Qt::EditRole, false);
+                             model->setData(proxyModel->mapToSource(index), data, Qt::EditRole);
                          }
                      },
                      [=]()
                      {
-                         model->endReset();
                          ui->tableView->setCurrentIndex(ui->tableView->model()->index(saved_row, saved_column));
                          ui->tableView->setFocus(Qt::OtherFocusReason);
                      });
@@ -1373,12 +1269,11 @@ void MainWindow::decreasePriority()
                                  data = data.replace("(" + m.captured(1) + ")", "(" + (QString(newValue)) + ")");
                              }
 
-                             model->setData(proxyModel->mapToSource(index), data, Qt::EditRole, false);
+                             model->setData(proxyModel->mapToSource(index), data, Qt::EditRole);
                          }
                      },
                      [=]()
                      {
-                         model->endReset();
                          ui->tableView->setCurrentIndex(ui->tableView->model()->index(saved_row, saved_column));
                          ui->tableView->setFocus(Qt::OtherFocusReason);
                      });
@@ -1387,12 +1282,19 @@ void MainWindow::decreasePriority()
 void MainWindow::forEachSelection(std::function<void(QModelIndex, QString)> func, std::function<void()> callback)
 {
     QModelIndexList indexes = ui->tableView->selectionModel()->selection().indexes();
+    std::set<int> rows;
 
+    // All the changes go into one transaction so that we get one write and one reparse no matter how many rows are selected
+    model->beginTransaction();
     for (QModelIndex index : indexes)
     {
+        if (!rows.insert(index.row()).second)
+            continue; // Both columns of a row are in the selection. Only handle the row once
         QString data = ui->tableView->model()->data(index, Qt::UserRole).toString();
         func(index, data);
     }
+    model->commitTransaction();
+    updateTitle();
 
     callback();
 }
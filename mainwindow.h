@@ -1,6 +1,7 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include <map>
 #include <QMainWindow>
 #include <QModelIndex>
 #include <uglobalhotkeys.h>
@@ -35,7 +36,7 @@ public:
     ~MainWindow();
 
 public slots:
-    void fileModified(const QString &str);
+    void filesChanged();
     void requestReceived(QNetworkReply *reply);
     void undo();
     void redo();
@@ -130,11 +131,12 @@ private slots:
 
     void on_lv_activetags_clicked(QModelIndex index);
 
+    void updateActiveTags(const std::map<QString, int> &tags);
+
 private:
     void setFileWatch();
     void requestPage(QString &s);
     void setTray();
-    void clearFileWatch();
     void closeEvent(QCloseEvent *ev);
     Ui::MainWindow *ui;
     void saveTableSelection();
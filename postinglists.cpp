@@ -0,0 +1,58 @@
+#include "postinglists.h"
+#include <algorithm>
+#include <iterator>
+
+postingLists::block &postingLists::writable(int id)
+{
+    // Only the thread that makes new versions copies blocks, so a block that no other version has
+    // can't get shared while it is written to
+    std::shared_ptr<block> &b = blocks[id / BLOCK];
+    if (b.use_count() > 1)
+        b = std::make_shared<block>(*b);
+    return *b;
+}
+
+void postingLists::append(const QString &name, const QString &lower, const std::vector<int> &tasks)
+{
+    if (count % BLOCK == 0)
+    {
+        blocks.push_back(std::make_shared<block>());
+        blocks.back()->names.reserve(BLOCK);
+        blocks.back()->lower.reserve(BLOCK);
+        blocks.back()->tasks.reserve(BLOCK);
+    }
+    block &b = writable(count);
+    b.names.push_back(name);
+    b.lower.push_back(lower);
+    b.tasks.push_back(tasks);
+    if (tasks.empty())
+        unusedIds++;
+    count++;
+}
+
+void postingLists::push(int id, int task)
+{
+    std::vector<int> &list = writable(id).tasks[id % BLOCK];
+    if (!list.empty() && list.back() >= task)
+        return;
+    if (list.empty())
+        unusedIds--;
+    list.push_back(task);
+}
+
+void postingLists::update(int id, const std::vector<int> &added, const std::vector<int> &removed)
+{
+    std::vector<int> &list = writable(id).tasks[id % BLOCK];
+    bool wasEmpty = list.empty();
+
+    std::vector<int> kept;
+    kept.reserve(list.size());
+    std::set_difference(list.begin(), list.end(), removed.begin(), removed.end(), std::back_inserter(kept));
+    list.clear();
+    std::set_union(kept.begin(), kept.end(), added.begin(), added.end(), std::back_inserter(list));
+
+    if (wasEmpty && !list.empty())
+        unusedIds--;
+    else if (!wasEmpty && list.empty())
+        unusedIds++;
+}
@@ -0,0 +1,43 @@
+/* Posting lists: for every id of a dictionary, like the tags or the words, the ids of the tasks that
+  have it, in ascending order.
+  An index is handed to the search thread and never changed after that. The lists are kept in blocks
+  that a copy of the index shares with the original, so making the next version of an index after a
+  change copies the list of blocks and the blocks that change, not every list.
+  */
+
+#ifndef POSTINGLISTS_H
+#define POSTINGLISTS_H
+
+#include <QString>
+#include <memory>
+#include <vector>
+
+class postingLists
+{
+public:
+    int size() const { return count; }
+    const QString &name(int id) const { return blocks[id / BLOCK]->names[id % BLOCK]; }
+    const QString &lower(int id) const { return blocks[id / BLOCK]->lower[id % BLOCK]; } // name in lower case
+    const std::vector<int> &tasks(int id) const { return blocks[id / BLOCK]->tasks[id % BLOCK]; }
+    int unused() const { return unusedIds; } // Ids that no task has
+
+    void append(const QString &name, const QString &lower, const std::vector<int> &tasks = std::vector<int>()); // Adds the next id
+    void push(int id, int task); // Adds a task above all the tasks id has, like when the lists are built in order
+    void update(int id, const std::vector<int> &added, const std::vector<int> &removed); // Both sorted
+
+protected:
+    enum { BLOCK = 256 };
+    struct block
+    {
+        std::vector<QString> names;
+        std::vector<QString> lower;
+        std::vector<std::vector<int>> tasks;
+    };
+    block &writable(int id); // The block of id, copied first if another version of the index has it as well
+
+    std::vector<std::shared_ptr<block>> blocks;
+    int count = 0;
+    int unusedIds = 0;
+};
+
+#endif // POSTINGLISTS_H
@@ -8,6 +8,7 @@
 #include "ui_settingsdialog.h"
 #include "globals.h"
 #include "def.h"
+#include "todosettings.h"
 
 #include <QSettings>
 
@@ -20,6 +21,7 @@ SettingsDialog::SettingsDialog(QWidget *parent) :
     ui->lineEdit->setText(settings.value(SETTINGS_DIRECTORY,DEFAULT_DIRECTORY).toString());
     ui->lineEdit_2->setText(settings.value(SETTINGS_INACTIVE,DEFAULT_INACTIVE).toString());
     ui->cb_autorefresh->setChecked(settings.value(SETTINGS_AUTOREFRESH,DEFAULT_AUTOREFRESH).toBool());
+    ui->sb_undoBudget->setValue(settings.value(SETTINGS_UNDO_BUDGET,DEFAULT_UNDO_BUDGET).toInt());
     ui->cb_separate->setChecked(settings.value(SETTINGS_SEPARATE_INACTIVES,DEFAULT_SEPARATE_INACTIVES).toBool());
     ui->cb_deletedfile->setChecked(settings.value(SETTINGS_DELETED_FILE,DEFAULT_DELETED_FILE).toBool());
     ui->cb_threshold->setChecked(settings.value(SETTINGS_THRESHOLD,DEFAULT_THRESHOLD).toBool());
@@ -67,6 +69,7 @@ void SettingsDialog::on_buttonBox_accepted()
     settings.setValue(SETTINGS_DIRECTORY,dir);
     settings.setValue(SETTINGS_INACTIVE,ui->lineEdit_2->text());
     settings.setValue(SETTINGS_AUTOREFRESH,ui->cb_autorefresh->isChecked());
+    settings.setValue(SETTINGS_UNDO_BUDGET,ui->sb_undoBudget->value());
     settings.setValue(SETTINGS_SEPARATE_INACTIVES,ui->cb_separate->isChecked());
     settings.setValue(SETTINGS_DATES,ui->cb_dates->isChecked());
     settings.setValue(SETTINGS_SHOW_DATES,ui->cb_showdates->isChecked());
@@ -87,6 +90,7 @@ void SettingsDialog::on_buttonBox_accepted()
     settings.setValue(SETTINGS_PRIO_ON_CLOSE,ui->comb_priorities->currentIndex());
     settings.setValue(SETTINGS_FONT_SIZE,ui->sb_fontSize->value());
     settings.setValue(SETTINGS_REMOVE_DOUBLETS,ui->cb_removeDoublets->isChecked());
+    TodoSettings::reload();
 
     refresh=true;
     this->close();
@@ -155,6 +159,7 @@ void SettingsDialog::on_pb_warningColor_clicked()
     QSettings settings;
     QColor c = QColorDialog::getRgba(settings.value(SETTINGS_DUE_WARNING_COLOR,DEFAULT_DUE_WARNING_COLOR).toInt());
     settings.setValue(SETTINGS_DUE_WARNING_COLOR,c.rgba());
+    TodoSettings::reload();
     updateFonts();
 }
 
@@ -163,6 +168,7 @@ void SettingsDialog::on_pb_lateColor_clicked()
     QSettings settings;
     QColor c = QColorDialog::getRgba(settings.value(SETTINGS_DUE_LATE_COLOR,DEFAULT_DUE_LATE_COLOR).toInt());
     settings.setValue(SETTINGS_DUE_LATE_COLOR,c.rgba());
+    TodoSettings::reload();
     updateFonts();
 
 }
@@ -0,0 +1,30 @@
+#-------------------------------------------------
+#
+# Checks todotxt::tokenize() against the patterns it replaced, on the lines in corpus.txt
+#
+#-------------------------------------------------
+
+QT       += core testlib
+
+TARGET = tst_tokenizer
+CONFIG += console testcase c++11
+CONFIG -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../..
+
+SOURCES += tst_tokenizer.cpp \
+    ../../todotxt.cpp \
+    ../../todosettings.cpp \
+    ../../linescanner.cpp \
+    ../../linearena.cpp \
+    ../../postinglists.cpp
+
+HEADERS += ../../todotxt.h \
+    ../../todosettings.h \
+    ../../linescanner.h \
+    ../../linearena.h \
+    ../../postinglists.h \
+    ../../def.h
+
+DISTFILES += corpus.txt
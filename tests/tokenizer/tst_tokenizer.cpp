@@ -0,0 +1,134 @@
+/* tokenize() replaced a set of regular expressions. These are those expressions, and every line of
+  corpus.txt is taken apart both ways. Lines that tripped up the tokenizer, or could, go in the corpus.
+  */
+
+#include <QtTest>
+#include <QRegularExpression>
+#include "todotxt.h"
+
+// A todo.txt line looks like this
+static QRegularExpression todo_line("(x\\s+)?(\\([A-Z]\\)\\s+)?(\\d\\d\\d\\d-\\d\\d-\\d\\d\\s+)?(\\d\\d\\d\\d-\\d\\d-\\d\\d\\s+)?(.*)");
+// These two wanted whitespace before the tag. A tag that starts the line is a tag too now
+static QRegularExpression regex_project("(?:^|\\s)(\\+[^\\s]+)");
+static QRegularExpression regex_context("(?:^|\\s)(\\@[^\\s]+)");
+static QRegularExpression regex_threshold_date("t:(\\d\\d\\d\\d-\\d\\d-\\d\\d)");
+static QRegularExpression regex_threshold_project("t:(\\+[^\\s]+)");
+static QRegularExpression regex_threshold_context("t:(\\@[^\\s]+)");
+static QRegularExpression regex_due_date("due:(\\d\\d\\d\\d-\\d\\d-\\d\\d)");
+static QRegularExpression regex_url("[a-zA-Z0-9_]+:\\/\\/([-a-zA-Z0-9@:%_\\+.~#?&\\/=\\(\\)\\{\\}\\\\]*)");
+
+// tokenize() is only for todotxt itself
+class tokenizer : public todotxt
+{
+public:
+    using todotxt::linetokens;
+    using todotxt::tokenize;
+};
+
+static QStringList captures(QRegularExpression &regex, const QString &line)
+{
+    QStringList found;
+    auto matches = regex.globalMatch(line);
+    while (matches.hasNext())
+        found << matches.next().captured(1);
+    return found;
+}
+
+static QStringList strings(const std::vector<QStringView> &views)
+{
+    QStringList found;
+    for (auto &v : views)
+        found << v.toString();
+    return found;
+}
+
+class TokenizerTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void header_data();
+    void header();
+    void words_data();
+    void words();
+
+protected:
+    static void corpus();
+};
+
+void TokenizerTest::corpus()
+{
+    QTest::addColumn<QString>("line");
+
+    QFile file(QFINDTESTDATA("corpus.txt"));
+    QVERIFY(file.open(QIODevice::ReadOnly | QIODevice::Text));
+    QTextStream in(&file);
+    in.setCodec("UTF-8");
+    int n = 0;
+    while (!in.atEnd())
+    {
+        QString line = in.readLine();
+        n++;
+        QTest::newRow(QString("line %1").arg(n).toUtf8().constData()) << line;
+    }
+}
+
+void TokenizerTest::header_data()
+{
+    corpus();
+}
+
+void TokenizerTest::header()
+{
+    QFETCH(QString, line);
+    tokenizer::linetokens k;
+    tokenizer::tokenize(line, k, false);
+
+    QRegularExpressionMatch match = todo_line.match(line);
+    QCOMPARE(k.checked, !match.captured(1).isEmpty());
+    QCOMPARE(k.priority.toString(), match.captured(2));
+    if (k.checked)
+    {
+        QCOMPARE(k.closedDate.toString(), match.captured(3));
+        QCOMPARE(k.createdDate.toString(), match.captured(4));
+    }
+    else
+    {
+        QCOMPARE(k.createdDate.toString(), match.captured(3)); // An open task only has the first date
+    }
+    QCOMPARE(k.text.toString(), match.captured(5));
+}
+
+void TokenizerTest::words_data()
+{
+    corpus();
+}
+
+void TokenizerTest::words()
+{
+    QFETCH(QString, line);
+    tokenizer::linetokens k;
+    tokenizer::tokenize(line, k, true);
+
+    QCOMPARE(strings(k.projects), captures(regex_project, line));
+    QCOMPARE(strings(k.contexts), captures(regex_context, line));
+    QCOMPARE(strings(k.thresholdProjects), captures(regex_threshold_project, line));
+    QCOMPARE(strings(k.thresholdContexts), captures(regex_threshold_context, line));
+
+    std::vector<int> thresholdDates;
+    for (const QString &date : captures(regex_threshold_date, line))
+        thresholdDates.push_back(todotxt::julianFrom(date));
+    QVERIFY(k.thresholdDates == thresholdDates);
+
+    QRegularExpressionMatch m = regex_due_date.match(line);
+    QCOMPARE(k.dueDate, m.hasMatch() ? todotxt::julianFrom(m.captured(1)) : INT_MAX);
+
+    m = regex_url.match(line);
+    QCOMPARE(k.urlStart, m.hasMatch() ? m.capturedStart(0) : -1);
+    if (m.hasMatch())
+        QCOMPARE(k.urlLength, m.capturedLength(0));
+}
+
+QTEST_APPLESS_MAIN(TokenizerTest)
+
+#include "tst_tokenizer.moc"
@@ -0,0 +1,166 @@
+#include "todofilewatcher.h"
+#include <QFileInfo>
+#include <QFile>
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+#define SETTLE_INTERVAL 250   // ms the files have to stay the same before they are taken as written
+#define MAX_SETTLE_CHECKS 20  // A file that never stops changing is reported after this many checks anyway
+#define POLL_MIN 1000         // ms between looks at the files after a change
+#define POLL_MAX 16000        // ms between looks when nothing has changed for a while. The longest a missed event goes unnoticed
+
+TodoFileWatcher::TodoFileWatcher(QObject *parent) : QObject(parent)
+{
+    timer.setSingleShot(true);
+    timer.setInterval(SETTLE_INTERVAL);
+    connect(&timer, &QTimer::timeout, this, &TodoFileWatcher::settle);
+    pollTimer.setSingleShot(true);
+    connect(&pollTimer, &QTimer::timeout, this, &TodoFileWatcher::poll);
+    connect(&watcher, &QFileSystemWatcher::fileChanged, this, &TodoFileWatcher::fileChanged);
+    connect(&watcher, &QFileSystemWatcher::directoryChanged, this, &TodoFileWatcher::directoryChanged);
+}
+
+void TodoFileWatcher::setFiles(const QStringList &files)
+{
+    clear();
+    this->files = files;
+
+    // The directories are watched as well, as a file that is replaced by a rename or deleted
+    // and written again is no longer the file that was watched
+    QStringList dirs;
+    for (const QString &f : files)
+    {
+        QString dir = QFileInfo(f).absolutePath();
+        if (!dirs.contains(dir))
+        {
+            dirs << dir;
+        }
+        seen.insert(f, statFile(f));
+    }
+    watcher.addPaths(dirs);
+    watchFiles();
+    pollTimer.start(POLL_MIN);
+}
+
+void TodoFileWatcher::clear()
+{
+    timer.stop();
+    pollTimer.stop();
+    checks = 0;
+    QStringList paths = watcher.files() + watcher.directories();
+    if (!paths.isEmpty())
+    {
+        watcher.removePaths(paths);
+    }
+    files.clear();
+    seen.clear();
+}
+
+TodoFileWatcher::fileState TodoFileWatcher::statFile(const QString &path)
+{
+    QFileInfo fi(path);
+    fileState s;
+    s.exists = fi.exists();
+    s.size = s.exists ? fi.size() : -1;
+    s.modified = fi.lastModified();
+    s.inode = 0;
+#ifdef Q_OS_UNIX
+    struct stat st;
+    if (s.exists && ::stat(QFile::encodeName(path).constData(), &st) == 0)
+    {
+        s.inode = (quint64)st.st_ino;
+    }
+#endif
+    return s;
+}
+
+void TodoFileWatcher::watchFiles()
+{
+    QStringList watched = watcher.files();
+    for (const QString &f : files)
+    {
+        if (!watched.contains(f) && QFileInfo::exists(f))
+        {
+            watcher.addPath(f);
+        }
+    }
+}
+
+void TodoFileWatcher::fileChanged(const QString &path)
+{
+    Q_UNUSED(path);
+    watchFiles();
+    startSettling();
+}
+
+void TodoFileWatcher::directoryChanged(const QString &path)
+{
+    Q_UNUSED(path);
+    // Other files in the directory change as well, like the backups some editors make. Only ours count
+    bool ours = false;
+    for (const QString &f : files)
+    {
+        if (statFile(f) != seen.value(f))
+        {
+            ours = true;
+            break;
+        }
+    }
+    if (ours)
+    {
+        watchFiles();
+        startSettling();
+    }
+}
+
+void TodoFileWatcher::startSettling()
+{
+    // Every event starts the wait over, so a burst of them ends in one check
+    for (const QString &f : files)
+    {
+        seen.insert(f, statFile(f));
+    }
+    checks = 0;
+    timer.start();
+    pollTimer.stop(); // Started again once the files have settled
+}
+
+void TodoFileWatcher::settle()
+{
+    // Still being written if anything differs from the last look
+    bool settled = true;
+    for (const QString &f : files)
+    {
+        fileState now = statFile(f);
+        if (now != seen.value(f))
+        {
+            settled = false;
+        }
+        seen.insert(f, now);
+    }
+    if (!settled && ++checks < MAX_SETTLE_CHECKS)
+    {
+        timer.start();
+        return;
+    }
+    checks = 0;
+    watchFiles();
+    pollTimer.start(POLL_MIN); // More changes tend to follow the first one
+    emit changed();
+}
+
+void TodoFileWatcher::poll()
+{
+    // Only a stat of each file. Reading it to see if the lines are different is left to the receiver of changed()
+    for (const QString &f : files)
+    {
+        if (statFile(f) != seen.value(f))
+        {
+            watchFiles();
+            startSettling();
+            return;
+        }
+    }
+    pollTimer.start(qMin(pollTimer.interval() * 2, POLL_MAX));
+}
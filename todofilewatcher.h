@@ -0,0 +1,61 @@
+/* Tells when the todo files have been changed by someone else and are done being written.
+  Editors and sync clients often write a file in several steps, or replace it with a new file, so
+  one save can give a burst of events and the first of them can come while the file is still
+  empty. This waits until the files have stopped changing before saying anything, and keeps the
+  files watched when they are replaced. Whether a change is our own write is up to the receiver,
+  which knows what it last wrote.
+  File system events don't come for every change on network shares, or when some sync clients
+  replace a file, so the files are also looked at every now and then. Looking is a stat of each
+  file, more often after something has changed and less often the longer nothing does.
+  */
+
+#ifndef TODOFILEWATCHER_H
+#define TODOFILEWATCHER_H
+
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QDateTime>
+#include <QHash>
+#include <QStringList>
+#include <QTimer>
+
+class TodoFileWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TodoFileWatcher(QObject *parent = 0);
+    void setFiles(const QStringList &files); // Replaces what is watched. Files that don't exist yet are watched for when they show up
+    void clear();
+
+signals:
+    void changed(); // One or more of the files have changed and have not changed since for a while
+
+protected slots:
+    void fileChanged(const QString &path);
+    void directoryChanged(const QString &path);
+    void settle();
+    void poll();
+
+protected:
+    struct fileState
+    {
+        bool exists;
+        qint64 size;
+        QDateTime modified;
+        quint64 inode; // A file put in place by a rename is another file, even with the same size and time. 0 where not known
+        bool operator==(const fileState &o) const { return exists == o.exists && size == o.size && modified == o.modified && inode == o.inode; }
+        bool operator!=(const fileState &o) const { return !(*this == o); }
+    };
+    static fileState statFile(const QString &path);
+    void watchFiles(); // Adds the files that exist but are not watched, like after they have been replaced
+    void startSettling();
+
+    QFileSystemWatcher watcher;
+    QStringList files;
+    QHash<QString, fileState> seen; // As of the last event or check
+    QTimer timer;
+    int checks = 0; // Checks since the last event that found the files still changing
+    QTimer pollTimer;
+};
+
+#endif // TODOFILEWATCHER_H
@@ -0,0 +1,624 @@
+#include "todofiltermodel.h"
+#include "todotablemodel.h"
+#include "todosettings.h"
+#include <QRegularExpression>
+#include <QtConcurrent>
+#include <algorithm>
+#include <iterator>
+
+#define RECENT_QUERIES 8 // Number of query results kept for when the user backspaces
+#define CANCEL_CHECK 1024 // The worker looks for a newer search every this many rows
+#define CHECK_IN_PLACE 256 // Changed rows up to this many are checked on the spot instead of searching them all again
+
+void TodoQuery::compile(const QString &text, const todotxt::tagIndex *index)
+{
+    terms.clear();
+
+    QStringList words = text.simplified().split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+    for (QString word : words)
+    {
+        term t;
+        t.exclude = false;
+        if (word.at(0) == '!')
+        {
+            t.exclude = true;
+            word.remove(0, 1);
+        }
+        if (word.isEmpty())
+            continue;
+
+        t.word = word.toLower();
+        t.type = (t.word.length() > 1 && (t.word.at(0) == '+' || t.word.at(0) == '@')) ? term::tag : term::text;
+
+        // A tag term matches any tag it is the start of, so that a half typed +proj still finds +project.
+        // Those are found once here, and the tasks are then checked by id
+        if (t.type == term::tag && index != NULL)
+        {
+            for (int id = 0; id < index->size(); id++)
+            {
+                if (index->lower(id).startsWith(t.word))
+                    t.ids.push_back(id);
+            }
+        }
+        terms.push_back(t);
+    }
+
+    std::stable_partition(terms.begin(), terms.end(), [](const term &t) { return t.type == term::tag; });
+}
+
+bool TodoQuery::isEmpty() const
+{
+    return terms.empty();
+}
+
+// Every term of the previous query has to be implied by a term of this one. A longer include word is
+// narrower than its start, while an exclude word removes more the shorter it is.
+bool TodoQuery::narrows(const TodoQuery &previous) const
+{
+    for (const term &p : previous.terms)
+    {
+        bool implied = false;
+        for (const term &q : terms)
+        {
+            if (q.type != p.type || q.exclude != p.exclude)
+                continue;
+            const QString &longer = q.exclude ? p.word : q.word;
+            const QString &shorter = q.exclude ? q.word : p.word;
+            if (q.type == term::tag ? longer.startsWith(shorter) : longer.contains(shorter))
+            {
+                implied = true;
+                break;
+            }
+        }
+        if (!implied)
+            return false;
+    }
+    return true;
+}
+
+static inline quint64 trigram(const QString &s, int i)
+{
+    return ((quint64)s.at(i).unicode() << 32) | ((quint64)s.at(i + 1).unicode() << 16) | (quint64)s.at(i + 2).unicode();
+}
+
+void TodoTrigramIndex::add(const todotxt::wordIndex &index)
+{
+    for (int id = words; id < index.size(); id++)
+    {
+        const QString &w = index.name(id);
+        for (int i = 0; i + 2 < w.length(); i++)
+        {
+            std::vector<int> &ids = grams[trigram(w, i)];
+            if (ids.empty() || ids.back() != id)
+                ids.push_back(id);
+        }
+    }
+    words = index.size();
+    epoch = index.epoch;
+}
+
+// The words that have all the trigrams of word. They still have to be checked, as the trigrams may be in another order
+bool TodoTrigramIndex::candidates(const QString &word, std::vector<int> &ids) const
+{
+    if (word.length() < 3)
+        return false;
+
+    std::vector<const std::vector<int> *> lists;
+    for (int i = 0; i + 2 < word.length(); i++)
+    {
+        auto it = grams.constFind(trigram(word, i));
+        if (it == grams.constEnd())
+        {
+            ids.clear();
+            return true; // No word has this trigram
+        }
+        lists.push_back(&it.value());
+    }
+    std::sort(lists.begin(), lists.end(), [](const std::vector<int> *a, const std::vector<int> *b) { return a->size() < b->size(); });
+
+    ids = *lists[0];
+    std::vector<int> out;
+    for (size_t i = 1; i < lists.size() && !ids.empty(); i++)
+    {
+        out.clear();
+        std::set_intersection(ids.begin(), ids.end(), lists[i]->begin(), lists[i]->end(), std::back_inserter(out));
+        ids.swap(out);
+    }
+    return true;
+}
+
+// The tasks that have a word with t.word in it, or a tag that starts with it
+void TodoQuery::postings(const term &t, const todotxt::wordIndex &words, const todotxt::tagIndex &tags, const TodoTrigramIndex *trigrams, std::vector<int> &ids)
+{
+    ids.clear();
+    if (t.type == term::tag)
+    {
+        for (int id : t.ids)
+        {
+            if (id < tags.size())
+                ids.insert(ids.end(), tags.tasks(id).begin(), tags.tasks(id).end());
+        }
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        return;
+    }
+
+    // Words the trigram index doesn't cover yet are looked through one by one
+    std::vector<int> candidates;
+    int from = 0;
+    if (trigrams != NULL && trigrams->epoch == words.epoch && trigrams->candidates(t.word, candidates))
+    {
+        for (int i : candidates)
+        {
+            if (i < words.size() && words.name(i).contains(t.word))
+                ids.insert(ids.end(), words.tasks(i).begin(), words.tasks(i).end());
+        }
+        from = trigrams->words;
+    }
+    for (int i = from; i < words.size(); i++)
+    {
+        if (words.name(i).contains(t.word))
+            ids.insert(ids.end(), words.tasks(i).begin(), words.tasks(i).end());
+    }
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+void TodoQuery::evaluate(const todotxt::wordIndex &words, const todotxt::tagIndex &tags, const TodoTrigramIndex *trigrams, int taskCount, std::vector<int> &ids) const
+{
+    bool first = true;
+    std::vector<int> list;
+    std::vector<int> out;
+
+    // Intersect the lists of the include terms...
+    for (const term &t : terms)
+    {
+        if (t.exclude)
+            continue;
+        postings(t, words, tags, trigrams, list);
+        if (first)
+        {
+            ids.swap(list);
+            first = false;
+        }
+        else
+        {
+            out.clear();
+            std::set_intersection(ids.begin(), ids.end(), list.begin(), list.end(), std::back_inserter(out));
+            ids.swap(out);
+        }
+        if (ids.empty())
+            return;
+    }
+
+    if (first)
+    {
+        // Only exclude terms, so start from everything
+        ids.resize(taskCount);
+        for (int i = 0; i < taskCount; i++)
+            ids[i] = i;
+    }
+
+    // ...and take away those of the exclude terms
+    for (const term &t : terms)
+    {
+        if (!t.exclude)
+            continue;
+        postings(t, words, tags, trigrams, list);
+        out.clear();
+        std::set_difference(ids.begin(), ids.end(), list.begin(), list.end(), std::back_inserter(out));
+        ids.swap(out);
+    }
+}
+
+QString TodoQuery::key() const
+{
+    QString k;
+    for (const term &t : terms)
+    {
+        k.append(t.exclude ? '!' : ' ');
+        k.append(t.word);
+    }
+    return k;
+}
+
+// Both lists are sorted, so they are walked side by side
+bool TodoQuery::hasTag(const std::vector<int> &tagIds, const std::vector<int> &ids)
+{
+    auto a = tagIds.begin();
+    auto b = ids.begin();
+    while (a != tagIds.end() && b != ids.end())
+    {
+        if (*a < *b)
+            a++;
+        else if (*b < *a)
+            b++;
+        else
+            return true;
+    }
+    return false;
+}
+
+// A search word has no spaces, so it is in the text exactly when it is in one of the words of the text
+bool TodoQuery::matches(const std::vector<int> &words, const std::vector<int> &tagIds, const todotxt::wordIndex &index) const
+{
+    for (const term &q : terms)
+    {
+        bool found;
+        if (q.type == term::tag)
+        {
+            found = hasTag(tagIds, q.ids);
+        }
+        else
+        {
+            found = std::any_of(words.begin(), words.end(), [&](int w) { return w < index.size() && index.name(w).contains(q.word); });
+        }
+
+        if (found == q.exclude)
+            return false;
+    }
+    return true;
+}
+
+TodoFilterModel::TodoFilterModel(QObject *parent) : QSortFilterProxyModel(parent)
+{
+    generation = std::make_shared<std::atomic<int>>(0);
+    connect(&watcher, &QFutureWatcher<searchResult>::finished, this, &TodoFilterModel::searchFinished);
+    connect(&trigramWatcher, &QFutureWatcher<std::shared_ptr<const TodoTrigramIndex>>::finished, this, &TodoFilterModel::trigramsFinished);
+    requery.setSingleShot(true);
+    requery.setInterval(0);
+    connect(&requery, &QTimer::timeout, this, &TodoFilterModel::searchAgain);
+}
+
+TodoFilterModel::~TodoFilterModel()
+{
+    // The worker only holds its own copies, so it is enough to tell it to stop
+    (*generation)++;
+    watcher.waitForFinished();
+    trigramWatcher.waitForFinished();
+}
+
+void TodoFilterModel::setSourceModel(QAbstractItemModel *model)
+{
+    for (auto &c : sourceConnections)
+        disconnect(c);
+    sourceConnections.clear();
+    forgetResults();
+
+    // Connected before the proxy connects its own handlers, so that the results are dropped before it filters again
+    if (model != NULL)
+    {
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::modelAboutToBeReset, this, &TodoFilterModel::forgetResults));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::layoutAboutToBeChanged, this, &TodoFilterModel::forgetResults));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsAboutToBeInserted, this, &TodoFilterModel::forgetResults));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsAboutToBeRemoved, this, &TodoFilterModel::forgetResults));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsAboutToBeMoved, this, &TodoFilterModel::forgetResults));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::dataChanged, this, &TodoFilterModel::sourceDataChanged));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::modelReset, this, &TodoFilterModel::compileQuery));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::layoutChanged, this, &TodoFilterModel::compileQuery));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsInserted, this, &TodoFilterModel::compileQuery));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsRemoved, this, &TodoFilterModel::compileQuery));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsMoved, this, &TodoFilterModel::compileQuery));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::modelReset, this, &TodoFilterModel::scheduleSearch));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::layoutChanged, this, &TodoFilterModel::scheduleSearch));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsInserted, this, &TodoFilterModel::scheduleSearch));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsRemoved, this, &TodoFilterModel::scheduleSearch));
+        sourceConnections.push_back(connect(model, &QAbstractItemModel::rowsMoved, this, &TodoFilterModel::scheduleSearch));
+    }
+    QSortFilterProxyModel::setSourceModel(model);
+    compileQuery();
+}
+
+void TodoFilterModel::forgetResults()
+{
+    (*generation)++; // A search that is running is for rows that are gone
+    searching = false;
+    haveResults = false;
+    countsStale = false;
+    matched.clear();
+    accepted.clear();
+    recent.clear();
+    snapshot.reset();
+    rowOf.reset();
+}
+
+// The rows stay where they are when only their data changes, so the results are kept and just the changed rows
+// are checked again. There are few of those, so that is done right here, before the proxy filters them
+void TodoFilterModel::sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    compileQuery();
+    recent.clear();
+    snapshot.reset();
+    rowOf.reset();
+
+    TodoTableModel *model = qobject_cast<TodoTableModel *>(sourceModel());
+    if (searching || !haveResults || model == NULL || query.key() != previousQuery.key() || bottomRight.row() - topLeft.row() >= CHECK_IN_PLACE)
+    {
+        forgetResults();
+        scheduleSearch();
+        return;
+    }
+
+    int rows = model->rowCount();
+    accepted.resize(rows, 0);
+    for (int row = qMax(topLeft.row(), 0); row <= bottomRight.row() && row < rows; row++)
+    {
+        const todotxt::todotask *task = model->task(row);
+        accepted[row] = task != NULL && query.matches(task->words, task->tagIds, *words);
+    }
+    matched.clear();
+    for (int row = 0; row < rows; row++)
+        if (accepted[row])
+            matched.push_back(row);
+    countsStale = true;
+    scheduleSearch();
+}
+
+void TodoFilterModel::scheduleSearch()
+{
+    // A change of the model comes as several signals, so this waits until they are all in
+    requery.start();
+}
+
+void TodoFilterModel::searchAgain()
+{
+    if (sourceModel() != NULL)
+        setQuery(queryText);
+}
+
+void TodoFilterModel::compileQuery()
+{
+    TodoTableModel *model = qobject_cast<TodoTableModel *>(sourceModel());
+    if (model != NULL)
+    {
+        tags = model->tagIndex();
+        words = model->wordIndex();
+    }
+    else
+    {
+        tags.reset();
+        words.reset();
+    }
+    query.compile(queryText, tags.get());
+    updateTrigrams();
+}
+
+void TodoFilterModel::updateTrigrams()
+{
+    const TodoSettings &settings = TodoSettings::current();
+    if (!settings.showAll || !settings.trigramIndex || !words)
+    {
+        trigrams.reset(); // Only worth the memory when done.txt is searched too
+        spare.reset();
+        return;
+    }
+    if (buildingTrigrams || (trigrams && trigrams->epoch == words->epoch && trigrams->words >= words->size()))
+        return;
+
+    // A search that is still running may have the spare, and then it can't be changed
+    std::shared_ptr<TodoTrigramIndex> next;
+    if (spare && spare.use_count() == 1)
+        next = std::const_pointer_cast<TodoTrigramIndex>(spare);
+    spare.reset();
+
+    buildingTrigrams = true;
+    trigramWatcher.setFuture(QtConcurrent::run(&TodoFilterModel::buildTrigrams, next, words));
+}
+
+// Runs on a worker thread. There are two indexes that take turns: the one the searches use, and the one
+// before it. The words only ever get added to, so the one before only needs the words since then to be the
+// next one, and no index is ever copied. Without one, or when the word ids have been given out anew, it starts over
+std::shared_ptr<const TodoTrigramIndex> TodoFilterModel::buildTrigrams(std::shared_ptr<TodoTrigramIndex> next, std::shared_ptr<const todotxt::wordIndex> words)
+{
+    bool keep = next && next->epoch == words->epoch;
+    auto index = keep ? next : std::make_shared<TodoTrigramIndex>();
+    index->add(*words);
+    return index;
+}
+
+void TodoFilterModel::trigramsFinished()
+{
+    buildingTrigrams = false;
+    const TodoSettings &settings = TodoSettings::current();
+    if (settings.showAll && settings.trigramIndex)
+    {
+        spare = trigrams;
+        trigrams = trigramWatcher.result();
+    }
+    updateTrigrams(); // There may be more words by now
+}
+
+std::shared_ptr<const std::vector<TodoSearchRow>> TodoFilterModel::getSnapshot()
+{
+    if (snapshot)
+        return snapshot;
+
+    auto rows = std::make_shared<std::vector<TodoSearchRow>>();
+    TodoTableModel *model = qobject_cast<TodoTableModel *>(sourceModel());
+    if (model != NULL)
+    {
+        taskCount = model->taskCount();
+        auto rowsOf = std::make_shared<std::vector<int>>(taskCount, -1);
+        int count = model->rowCount(QModelIndex());
+        rows->resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            const todotxt::todotask *task = model->task(i);
+            if (task == NULL)
+                continue;
+            TodoSearchRow &r = (*rows)[i];
+            r.id = task->id;
+            if (task->id >= 0 && task->id < taskCount)
+                (*rowsOf)[task->id] = i;
+        }
+        rowOf = rowsOf;
+    }
+    snapshot = rows;
+    return snapshot;
+}
+
+void TodoFilterModel::setQuery(const QString &text)
+{
+    // A task keeps its id as long as its line is there, so results stay good when the indexes are made
+    // again. Rows that come and go are taken care of by the row signals. The query only has to see new tags
+    TodoTableModel *model = qobject_cast<TodoTableModel *>(sourceModel());
+    if (model != NULL && model->tagIndex() != tags)
+        compileQuery();
+
+    queryText = text;
+    query.compile(text, tags.get());
+    QString key = query.key();
+    if (!countsStale && (searching ? key == pendingKey : (haveResults && key == previousQuery.key())))
+        return; // Nothing that changes what is shown, like an added space
+    countsStale = false;
+
+    int current = ++(*generation); // Cancels whatever is running
+    searching = false;
+
+    auto hit = std::find_if(recent.begin(), recent.end(), [&](const searchResult &r) { return r.key == key; });
+    if (hit != recent.end())
+    {
+        std::rotate(recent.begin(), hit, hit + 1);
+        searchResult result = recent.front();
+        showResult(result);
+        return;
+    }
+
+    searchJob job;
+    job.rows = getSnapshot();
+    job.tags = tags;
+    job.words = words;
+    job.rowOf = rowOf;
+    job.trigrams = trigrams;
+    job.taskCount = taskCount;
+    job.query = query;
+    job.allRows = !(haveResults && query.narrows(previousQuery));
+    if (!job.allRows)
+        job.candidates = matched;
+    job.generation = current;
+    job.current = generation;
+
+    searching = true;
+    pendingKey = key;
+    watcher.setFuture(QtConcurrent::run(&TodoFilterModel::search, job));
+}
+
+// Runs on a worker thread. Everything it uses is its own copy, apart from the generation counter
+TodoFilterModel::searchResult TodoFilterModel::search(searchJob job)
+{
+    searchResult result;
+    result.generation = job.generation;
+    result.cancelled = false;
+    result.key = job.query.key();
+
+    std::vector<int> ids;
+    if (job.words && job.tags && job.rowOf && !job.query.isEmpty())
+    {
+        // The indexes give the matching task ids straight away, so this costs about as much as there are hits
+        std::vector<int> found;
+        job.query.evaluate(*job.words, *job.tags, job.trigrams.get(), job.taskCount, found);
+        if (*job.current != job.generation)
+        {
+            result.cancelled = true;
+            return result;
+        }
+        for (int id : found)
+        {
+            int row = id < (int)job.rowOf->size() ? (*job.rowOf)[id] : -1;
+            if (row < 0)
+                continue; // Not shown, for example because of a threshold
+            if (!job.allRows && !std::binary_search(job.candidates.begin(), job.candidates.end(), row))
+                continue; // A refined query only keeps rows that the one before it matched
+            result.matched.push_back(row);
+            ids.push_back(id);
+        }
+        std::sort(result.matched.begin(), result.matched.end());
+
+        todotxt::countTags(*job.tags, ids, job.taskCount, result.tags);
+        return result;
+    }
+
+    // Nothing is looked for, so every row is shown. There is always an index to look in otherwise
+    if (!job.query.isEmpty())
+        return result;
+    int count = job.allRows ? (int)job.rows->size() : (int)job.candidates.size();
+    for (int i = 0; i < count; i++)
+    {
+        if (i % CANCEL_CHECK == 0 && *job.current != job.generation)
+        {
+            result.cancelled = true;
+            return result;
+        }
+
+        int row = job.allRows ? i : job.candidates[i];
+        const TodoSearchRow &r = (*job.rows)[row];
+        result.matched.push_back(row);
+        ids.push_back(r.id);
+    }
+
+    if (job.tags)
+        todotxt::countTags(*job.tags, ids, job.taskCount, result.tags);
+    return result;
+}
+
+void TodoFilterModel::searchFinished()
+{
+    if (!searching)
+        return; // Already shown by waitForResults()
+
+    searchResult result = watcher.result();
+    if (result.cancelled || result.generation != *generation)
+        return; // A newer search has been started
+
+    searching = false;
+    recent.insert(recent.begin(), result);
+    if ((int)recent.size() > RECENT_QUERIES)
+        recent.pop_back();
+
+    showResult(result);
+}
+
+void TodoFilterModel::showResult(const searchResult &result)
+{
+    int rows = sourceModel() != NULL ? sourceModel()->rowCount() : 0;
+    matched = result.matched;
+    accepted.assign(rows, 0);
+    for (int row : matched)
+        if (row < rows)
+            accepted[row] = 1;
+    haveResults = true;
+    previousQuery = query;
+
+    invalidateFilter();
+    emit resultsReady(result.tags);
+}
+
+void TodoFilterModel::waitForResults()
+{
+    if (!searching)
+        return;
+    watcher.waitForFinished();
+    searchFinished();
+}
+
+bool TodoFilterModel::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
+{
+    Q_UNUSED(source_parent);
+    if (query.isEmpty())
+        return true;
+
+    // Shows the last results until a running search is done
+    if (haveResults)
+        return source_row >= 0 && source_row < (int)accepted.size() && accepted[source_row];
+
+    // The source model changed since the last search, so check the row right here
+    TodoTableModel *model = qobject_cast<TodoTableModel *>(sourceModel());
+    if (model == NULL)
+        return true;
+
+    const todotxt::todotask *task = model->task(source_row);
+    if (task == NULL)
+        return false;
+
+    return query.matches(task->words, task->tagIds, *model->wordIndex());
+}
@@ -0,0 +1,149 @@
+/* The filtered view of the todo list that the table shows.
+  The search and context boxes are compiled into a TodoQuery once per change of the text. The query
+  is run on a worker thread against a snapshot of the task records, and the rows that matched are
+  handed back to filterAcceptsRow(). A newer query cancels one that is still running, so typing
+  never waits for a search.
+  */
+
+#ifndef TODOFILTERMODEL_H
+#define TODOFILTERMODEL_H
+
+#include <QSortFilterProxyModel>
+#include <QFutureWatcher>
+#include <QTimer>
+#include <QHash>
+#include <vector>
+#include <map>
+#include <memory>
+#include <atomic>
+#include "todotxt.h"
+
+// What the search needs from a row. Copies of these are safe to read from another thread.
+// The text and tags of the task are in the indexes, so this is only where to find it there
+struct TodoSearchRow
+{
+    int id = -1;                // The id of the task
+};
+
+// Which of the distinct words have each sequence of three characters. In show-all mode there are many more
+// words, and this finds the few that a search word can be part of without looking at all of them
+struct TodoTrigramIndex
+{
+    int words = 0;                          // Word ids below this are in the index
+    int epoch = 0;                          // The epoch of the word index the ids are from
+    QHash<quint64, std::vector<int>> grams; // Word ids in ascending order
+    void add(const todotxt::wordIndex &index); // Adds the words of index that are not in here yet
+    bool candidates(const QString &word, std::vector<int> &ids) const; // False if word is too short for the index to help
+};
+
+// A search like "word +project !other" is a list of terms that all have to hold for a task to be shown
+class TodoQuery
+{
+public:
+    void compile(const QString &text, const todotxt::tagIndex *index); // index is used to look up the ids of tag terms
+    bool matches(const std::vector<int> &words, const std::vector<int> &tagIds, const todotxt::wordIndex &index) const; // words are ids in index
+    // Finds the ids of all tasks that match with the indexes instead of looking at every task. They come out sorted
+    void evaluate(const todotxt::wordIndex &words, const todotxt::tagIndex &tags, const TodoTrigramIndex *trigrams, int taskCount, std::vector<int> &ids) const;
+    bool isEmpty() const;
+    bool narrows(const TodoQuery &previous) const; // True if everything this matches is also matched by previous
+    QString key() const;                           // The same for queries with the same terms
+
+protected:
+    struct term
+    {
+        enum { text, tag } type; // tag terms start with + or @ and are looked up in the tags of the task
+        bool exclude;            // The word was prefixed with !
+        QString word;            // Lower-cased
+        std::vector<int> ids;    // For tag terms, the ids of the tags that start with word, sorted
+    };
+
+    static bool hasTag(const std::vector<int> &tagIds, const std::vector<int> &ids);
+    static void postings(const term &t, const todotxt::wordIndex &words, const todotxt::tagIndex &tags, const TodoTrigramIndex *trigrams, std::vector<int> &ids);
+
+    std::vector<term> terms; // Tag terms go first as they are the cheapest to check
+};
+
+class TodoFilterModel : public QSortFilterProxyModel
+{
+    Q_OBJECT
+public:
+    explicit TodoFilterModel(QObject *parent = 0);
+    ~TodoFilterModel();
+    void setQuery(const QString &text); // Starts a search. resultsReady() is emitted when it is shown
+    void waitForResults();              // Blocks until the last search is shown
+    void setSourceModel(QAbstractItemModel *model);
+
+signals:
+    void resultsReady(const std::map<QString, int> &tags); // Number of shown tasks per project and context
+
+protected slots:
+    void forgetResults(); // The rows of the source model changed, so the saved results are no longer valid
+    void compileQuery();  // The source model changed, so there may be new tags for the query to know about
+    void sourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight); // Checks the changed rows again
+    void scheduleSearch(); // Searches again once the source model is done changing, so resultsReady() is emitted
+    void searchAgain();
+    void trigramsFinished();
+    void searchFinished();
+
+protected:
+    struct searchJob
+    {
+        std::shared_ptr<const std::vector<TodoSearchRow>> rows;
+        TodoQuery query;
+        std::vector<int> candidates; // Rows to look at, unless allRows is set
+        std::shared_ptr<const todotxt::tagIndex> tags;
+        std::shared_ptr<const todotxt::wordIndex> words;  // The search uses the indexes when it has them
+        std::shared_ptr<const std::vector<int>> rowOf;
+        std::shared_ptr<const TodoTrigramIndex> trigrams; // May be missing or not cover the newest words
+        int taskCount;
+        bool allRows;
+        int generation;
+        std::shared_ptr<std::atomic<int>> current; // Differs from generation once a newer search has started
+    };
+    struct searchResult
+    {
+        int generation;
+        bool cancelled;
+        QString key;
+        std::vector<int> matched;
+        std::map<QString, int> tags;
+    };
+
+    bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const;
+    std::shared_ptr<const std::vector<TodoSearchRow>> getSnapshot();
+    static searchResult search(searchJob job);
+    void showResult(const searchResult &result);
+    void updateTrigrams(); // Starts adding new words to the trigram index in the background, if it is used
+    static std::shared_ptr<const TodoTrigramIndex> buildTrigrams(std::shared_ptr<TodoTrigramIndex> next, std::shared_ptr<const todotxt::wordIndex> words);
+
+    QString queryText;
+    TodoQuery query;         // What is being searched for, or was searched for last
+    TodoQuery previousQuery; // The query that matched was found for
+    bool searching = false;
+    QString pendingKey;      // The key of the search that is running
+
+    // As the user types, the query mostly gets narrower. So we keep the rows that matched and only
+    // look at those again when the query is refined. A few recent results are kept for backspacing.
+    bool haveResults = false;
+    bool countsStale = false;       // Rows were checked again after a change, so the tag counts have to be counted again
+    std::vector<int> matched;       // Source rows that match previousQuery, in order
+    std::vector<char> accepted;     // The same, indexed by source row
+    std::vector<searchResult> recent; // Most recently used first
+    std::vector<QMetaObject::Connection> sourceConnections;
+
+    std::shared_ptr<const std::vector<TodoSearchRow>> snapshot; // Built from the source model on the first search after it changes
+    std::shared_ptr<const todotxt::tagIndex> tags;               // Taken from the source model when it changes
+    std::shared_ptr<const todotxt::wordIndex> words;             // Taken from the source model when it changes
+    std::shared_ptr<const std::vector<int>> rowOf;               // The row of every task id in the snapshot, -1 if it isn't shown
+    int taskCount = 0;
+    std::shared_ptr<std::atomic<int>> generation;               // Bumped to cancel the running search
+    QFutureWatcher<searchResult> watcher;
+    QTimer requery;
+
+    std::shared_ptr<const TodoTrigramIndex> trigrams;
+    std::shared_ptr<const TodoTrigramIndex> spare; // The one before trigrams, made into the next one once no search has it
+    QFutureWatcher<std::shared_ptr<const TodoTrigramIndex>> trigramWatcher;
+    bool buildingTrigrams = false;
+};
+
+#endif // TODOFILTERMODEL_H
@@ -0,0 +1,150 @@
+#include "todoitemdelegate.h"
+#include "todotablemodel.h"
+#include "todotxt.h"
+#include <QApplication>
+#include <QPainter>
+#include <QTextOption>
+#include <QtMath>
+
+#define LAYOUT_CACHE 512 // Laid out rows to keep. Only rows that have been on screen get laid out
+
+TodoItemDelegate::TodoItemDelegate(QObject *parent) : QStyledItemDelegate(parent)
+{
+    layouts.setMaxCost(LAYOUT_CACHE);
+}
+
+int TodoItemDelegate::textMargin(const QStyleOptionViewItem &option)
+{
+    QStyle *style = option.widget ? option.widget->style() : QApplication::style();
+    return style->pixelMetric(QStyle::PM_FocusFrameHMargin, 0, option.widget) + 1;
+}
+
+TodoItemDelegate::layoutEntry TodoItemDelegate::layoutFor(const QStyleOptionViewItem &option, const QModelIndex &index, int width) const
+{
+    int style = index.data(TodoTableModel::StyleRole).toInt();
+    layoutEntry *cached = layouts.object(option.text);
+    if (cached && cached->style == style && cached->width == width && cached->font == option.font)
+        return *cached;
+
+    layoutEntry e;
+    e.style = style;
+    e.width = width;
+    e.font = option.font;
+    e.layout = std::make_shared<QTextLayout>(option.text, option.font);
+
+    QTextOption textOption;
+    textOption.setWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
+    textOption.setTextDirection(option.direction);
+    e.layout->setTextOption(textOption);
+    e.layout->setCacheEnabled(true);
+
+    QVector<int> spans = index.data(TodoTableModel::SpansRole).value<QVector<int>>();
+    QVector<QTextLayout::FormatRange> formats;
+    for (int i = 0; i + 2 < spans.size(); i += 3)
+    {
+        QTextLayout::FormatRange f;
+        f.start = spans[i];
+        f.length = spans[i + 1];
+        switch (spans[i + 2])
+        {
+        case todotxt::textSpan::priority:
+            f.format.setFontWeight(QFont::Bold);
+            break;
+        case todotxt::textSpan::project:
+            f.format.setForeground(option.palette.brush(QPalette::Link));
+            break;
+        case todotxt::textSpan::context:
+            f.format.setForeground(option.palette.brush(QPalette::LinkVisited));
+            break;
+        case todotxt::textSpan::due:
+            f.format.setFontItalic(true);
+            break;
+        }
+        formats << f;
+    }
+    e.layout->setFormats(formats);
+
+    qreal height = 0;
+    e.layout->beginLayout();
+    while (true)
+    {
+        QTextLine line = e.layout->createLine();
+        if (!line.isValid())
+            break;
+        line.setLineWidth(width);
+        line.setPosition(QPointF(0, height));
+        height += line.height();
+    }
+    e.layout->endLayout();
+    e.height = height;
+
+    layouts.insert(option.text, new layoutEntry(e));
+    return e;
+}
+
+void TodoItemDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    if (index.column() != 1)
+    {
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+
+    QStyleOptionViewItem opt = option;
+    initStyleOption(&opt, index);
+    const QWidget *widget = opt.widget;
+    QStyle *style = widget ? widget->style() : QApplication::style();
+
+    // The style draws the background, the selection and the focus frame. The text goes on top
+    QString text = opt.text;
+    opt.text.clear();
+    style->drawControl(QStyle::CE_ItemViewItem, &opt, painter, widget);
+    if (text.isEmpty())
+        return;
+    opt.text = text;
+
+    // The text column has no check box or icon, so the text gets all of the cell but the margins
+    int margin = textMargin(opt);
+    QRect rect = opt.rect.adjusted(margin, 0, -margin, 0);
+    const layoutEntry &e = layoutFor(opt, index, rect.width());
+
+    QPalette::ColorGroup cg = !(opt.state & QStyle::State_Enabled) ? QPalette::Disabled : (opt.state & QStyle::State_Active) ? QPalette::Normal : QPalette::Inactive;
+    bool selected = opt.state & QStyle::State_Selected;
+
+    // On a selected row the highlighted text colour goes over the colours of the spans
+    QVector<QTextLayout::FormatRange> selections;
+    if (selected)
+    {
+        QTextLayout::FormatRange all;
+        all.start = 0;
+        all.length = text.length();
+        all.format.setForeground(opt.palette.brush(cg, QPalette::HighlightedText));
+        selections << all;
+    }
+
+    painter->save();
+    painter->setClipRect(rect);
+    painter->setPen(opt.palette.color(cg, selected ? QPalette::HighlightedText : QPalette::Text));
+    qreal y = rect.top() + qMax<qreal>(0, (rect.height() - e.height) / 2);
+    e.layout->draw(painter, QPointF(rect.left(), y), selections);
+    painter->restore();
+}
+
+QSize TodoItemDelegate::sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const
+{
+    if (index.column() != 1)
+        return QStyledItemDelegate::sizeHint(option, index);
+
+    QStyleOptionViewItem opt = option;
+    initStyleOption(&opt, index);
+    int margin = textMargin(opt);
+    int width = opt.rect.width() - 2 * margin;
+    if (width <= 0 || opt.text.isEmpty())
+        return QStyledItemDelegate::sizeHint(option, index); // Not asked about a width, like when fitting the column
+
+    // The same layout that paint() will use, so the row is exactly as high as the text
+    const layoutEntry &e = layoutFor(opt, index, width);
+    QStyle *style = opt.widget ? opt.widget->style() : QApplication::style();
+    int vmargin = style->pixelMetric(QStyle::PM_FocusFrameVMargin, 0, opt.widget) + 1;
+    return QSize(opt.rect.width(), qCeil(e.height) + 2 * vmargin);
+}
@@ -0,0 +1,40 @@
+/* Draws the text column of the todo table.
+  The default delegate lays out the wrapped text again on every paint. This keeps the laid out
+  text of each row, for the width it was laid out at, until the model says the row would look
+  different. Priorities, projects, contexts and due dates are drawn in their own style from the
+  spans that were found when the line was parsed.
+  */
+
+#ifndef TODOITEMDELEGATE_H
+#define TODOITEMDELEGATE_H
+
+#include <QStyledItemDelegate>
+#include <QTextLayout>
+#include <QCache>
+#include <memory>
+
+class TodoItemDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+public:
+    explicit TodoItemDelegate(QObject *parent = 0);
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const;
+
+protected:
+    struct layoutEntry
+    {
+        int style;  // The StyleRole of the row when it was laid out
+        int width;
+        QFont font; // What the view resolved the font of the row to
+        qreal height;
+        std::shared_ptr<QTextLayout> layout;
+    };
+
+    layoutEntry layoutFor(const QStyleOptionViewItem &option, const QModelIndex &index, int width) const;
+    static int textMargin(const QStyleOptionViewItem &option);
+
+    mutable QCache<QString, layoutEntry> layouts; // By the text of the row. The rows that were on screen last are kept
+};
+
+#endif // TODOITEMDELEGATE_H
@@ -0,0 +1,129 @@
+#include "todorowheights.h"
+#include <QHeaderView>
+#include <QScrollBar>
+#include <QEvent>
+#include <QFont>
+
+#define ROW_HEIGHT_BUCKETS 4 // Number of column widths to keep measured heights for, like maximized and restored
+#define ROW_HEIGHTS 4096      // Measured heights to keep for each width
+
+TodoRowHeights::TodoRowHeights(QTableView *view) : QObject(view), view(view)
+{
+    timer.setSingleShot(true);
+    timer.setInterval(0);
+    connect(&timer, &QTimer::timeout, this, &TodoRowHeights::update);
+
+    connect(view->horizontalHeader(), &QHeaderView::sectionResized, this, &TodoRowHeights::schedule);
+    connect(view->verticalScrollBar(), &QScrollBar::valueChanged, this, &TodoRowHeights::schedule);
+    view->viewport()->installEventFilter(this); // A taller window shows more rows without resizing a column
+}
+
+void TodoRowHeights::setModel(QAbstractItemModel *model)
+{
+    for (auto &c : modelConnections)
+    {
+        disconnect(c);
+    }
+    modelConnections.clear();
+
+    if (model)
+    {
+        // Changed rows have a different text, so their old heights are simply not found in the cache
+        modelConnections << connect(model, &QAbstractItemModel::modelReset, this, &TodoRowHeights::schedule);
+        modelConnections << connect(model, &QAbstractItemModel::layoutChanged, this, &TodoRowHeights::schedule);
+        modelConnections << connect(model, &QAbstractItemModel::rowsInserted, this, &TodoRowHeights::schedule);
+        modelConnections << connect(model, &QAbstractItemModel::rowsRemoved, this, &TodoRowHeights::schedule);
+        modelConnections << connect(model, &QAbstractItemModel::rowsMoved, this, &TodoRowHeights::schedule);
+        modelConnections << connect(model, &QAbstractItemModel::dataChanged, this, &TodoRowHeights::schedule);
+    }
+    schedule();
+}
+
+void TodoRowHeights::schedule()
+{
+    if (!timer.isActive())
+    {
+        timer.start();
+    }
+}
+
+bool TodoRowHeights::eventFilter(QObject *watched, QEvent *event)
+{
+    if (event->type() == QEvent::Resize)
+    {
+        schedule();
+    }
+    return QObject::eventFilter(watched, event);
+}
+
+TodoRowHeights::bucket &TodoRowHeights::bucketFor(int width)
+{
+    for (auto it = buckets.begin(); it != buckets.end(); ++it)
+    {
+        if ((*it)->width == width)
+        {
+            if (it != buckets.begin())
+            {
+                std::unique_ptr<bucket> b = std::move(*it);
+                buckets.erase(it);
+                buckets.push_front(std::move(b));
+            }
+            return *buckets.front();
+        }
+    }
+
+    std::unique_ptr<bucket> b(new bucket);
+    b->width = width;
+    b->heights.setMaxCost(ROW_HEIGHTS);
+    buckets.push_front(std::move(b));
+    if (buckets.size() > ROW_HEIGHT_BUCKETS)
+    {
+        buckets.pop_back();
+    }
+    return *buckets.front();
+}
+
+// Goes down from the top row until the bottom of the viewport. Growing a row pushes the ones below it
+// out of view, so the end is found while walking instead of up front
+void TodoRowHeights::update()
+{
+    QAbstractItemModel *model = view->model();
+    if (!model)
+        return;
+
+    int row = view->rowAt(0);
+    if (row < 0)
+        return;
+
+    bucket &b = bucketFor(view->columnWidth(1));
+    int rows = model->rowCount();
+    int bottom = view->viewport()->height();
+    for (int y = view->rowViewportPosition(row); row < rows && y < bottom; row++)
+    {
+        if (view->isRowHidden(row))
+            continue;
+
+        QModelIndex index = model->index(row, 1);
+        QString key = index.data(Qt::DisplayRole).toString(); // What is shown, which depends on settings like showDates as well
+        key += QChar(0);
+        key += index.data(Qt::FontRole).value<QFont>().key();
+
+        int height;
+        int *cached = b.heights.object(key);
+        if (!cached)
+        {
+            height = view->sizeHintForRow(row);
+            b.heights.insert(key, new int(height));
+        }
+        else
+        {
+            height = *cached;
+        }
+
+        if (view->rowHeight(row) != height)
+        {
+            view->setRowHeight(row, height);
+        }
+        y += height;
+    }
+}
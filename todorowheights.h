@@ -0,0 +1,49 @@
+/* Word wrapped row heights for the todo table.
+  QTableView::resizeRowsToContents() measures every row in the model, which on a long list makes
+  resizing the window freeze. This sizes only the rows that are on screen, once control is back
+  in the event loop, and remembers the measured heights for the last few column widths. Rows that
+  have never been on screen keep the default height, or the last height they had, as an estimate.
+  */
+
+#ifndef TODOROWHEIGHTS_H
+#define TODOROWHEIGHTS_H
+
+#include <QObject>
+#include <QCache>
+#include <QTimer>
+#include <QTableView>
+#include <deque>
+#include <memory>
+
+class TodoRowHeights : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TodoRowHeights(QTableView *view);
+    void setModel(QAbstractItemModel *model); // Call after giving the view a model
+
+public slots:
+    void schedule(); // Sizes the visible rows once control is back in the event loop
+
+protected slots:
+    void update();
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event);
+
+    // The heights measured at one width of the text column, by the text shown and the font it is shown in.
+    // Texts that have not been on screen for a while are dropped, so edits don't make it grow forever
+    struct bucket
+    {
+        int width;
+        QCache<QString, int> heights;
+    };
+    bucket &bucketFor(int width);
+
+    QTableView *view;
+    std::deque<std::unique_ptr<bucket>> buckets; // Most recently used first
+    QTimer timer;
+    QList<QMetaObject::Connection> modelConnections;
+};
+
+#endif // TODOROWHEIGHTS_H
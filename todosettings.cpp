@@ -0,0 +1,68 @@
+#include "todosettings.h"
+#include "def.h"
+
+#include <QSettings>
+
+static TodoSettings *instance = NULL;
+
+TodoSettings::TodoSettings()
+{
+    load();
+}
+
+const TodoSettings &TodoSettings::current()
+{
+    if (instance == NULL)
+    {
+        instance = new TodoSettings();
+    }
+    return *instance;
+}
+
+void TodoSettings::reload()
+{
+    if (instance == NULL)
+    {
+        instance = new TodoSettings();
+    }
+    else
+    {
+        instance->load();
+    }
+}
+
+void TodoSettings::load()
+{
+    QSettings settings;
+    generation++;
+    directory = settings.value(SETTINGS_DIRECTORY, DEFAULT_DIRECTORY).toString();
+    inactive = settings.value(SETTINGS_INACTIVE).toString();
+    inactives.clear();
+    if (!inactive.isEmpty())
+    {
+        inactives = inactive.split(";");
+    }
+    separateInactives = settings.value(SETTINGS_SEPARATE_INACTIVES, DEFAULT_SEPARATE_INACTIVES).toBool();
+    threshold = settings.value(SETTINGS_THRESHOLD, DEFAULT_THRESHOLD).toBool();
+    thresholdLabels = settings.value(SETTINGS_THRESHOLD_LABELS, DEFAULT_THRESHOLD_LABELS).toBool();
+    thresholdInactive = settings.value(SETTINGS_THRESHOLD_INACTIVE, DEFAULT_THRESHOLD_INACTIVE).toBool();
+    showDates = settings.value(SETTINGS_SHOW_DATES, DEFAULT_SHOW_DATES).toBool();
+    showAll = settings.value(SETTINGS_SHOW_ALL, DEFAULT_SHOW_ALL).toBool();
+    sortAlpha = settings.value(SETTINGS_SORT_ALPHA).toBool();
+    dates = settings.value(SETTINGS_DATES, DEFAULT_DATES).toBool();
+    due = settings.value(SETTINGS_DUE, DEFAULT_DUE).toBool();
+    dueWarning = settings.value(SETTINGS_DUE_WARNING, DEFAULT_DUE_WARNING).toInt();
+    prioOnClose = settings.value(SETTINGS_PRIO_ON_CLOSE, DEFAULT_PRIO_ON_CLOSE).toInt();
+    removeDoublets = settings.value(SETTINGS_REMOVE_DOUBLETS, DEFAULT_REMOVE_DOUBLETS).toBool();
+    deletedFile = settings.value(SETTINGS_DELETED_FILE, DEFAULT_DELETED_FILE).toBool();
+    liveSearch = settings.value(SETTINGS_LIVE_SEARCH, DEFAULT_LIVE_SEARCH).toBool();
+    autorefresh = settings.value(SETTINGS_AUTOREFRESH).toBool();
+    undoBudget = settings.value(SETTINGS_UNDO_BUDGET, DEFAULT_UNDO_BUDGET).toLongLong() * 1024;
+    trigramIndex = settings.value(SETTINGS_TRIGRAM_INDEX, DEFAULT_TRIGRAM_INDEX).toBool();
+    activeFont = settings.value(SETTINGS_ACTIVE_FONT).toString();
+    inactiveFont = settings.value(SETTINGS_INACTIVE_FONT).toString();
+    activeColor = settings.value(SETTINGS_ACTIVE_COLOR, DEFAULT_ACTIVE_COLOR).toUInt();
+    inactiveColor = settings.value(SETTINGS_INACTIVE_COLOR, DEFAULT_INACTIVE_COLOR).toUInt();
+    dueWarningColor = settings.value(SETTINGS_DUE_WARNING_COLOR, DEFAULT_DUE_WARNING_COLOR).toUInt();
+    dueLateColor = settings.value(SETTINGS_DUE_LATE_COLOR, DEFAULT_DUE_LATE_COLOR).toUInt();
+}
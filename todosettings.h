@@ -0,0 +1,54 @@
+/* A snapshot of the settings that are used when parsing and showing the todo list.
+  Looking things up in QSettings means a string key lookup every time, which is too slow to do
+  for every row on every repaint. So the values are read once into plain fields here, and
+  reload() is called whenever something changes a setting.
+  */
+
+#ifndef TODOSETTINGS_H
+#define TODOSETTINGS_H
+
+#include <QString>
+#include <QStringList>
+#include <QRgb>
+
+class TodoSettings
+{
+public:
+    static const TodoSettings &current();
+    static void reload(); // Read QSettings again. Call this after changing a setting
+
+    int generation = 0;         // Goes up every time the settings are read, so that anything made from them knows when to redo it
+
+    QString directory;
+    QString inactive;           // SETTINGS_INACTIVE as it is
+    QStringList inactives;      // ...and split on ';'. Empty if there are no inactive markers
+    bool separateInactives;
+    bool threshold;
+    bool thresholdLabels;
+    bool thresholdInactive;
+    bool showDates;
+    bool showAll;
+    bool sortAlpha;
+    bool dates;
+    bool due;
+    int dueWarning;
+    int prioOnClose;
+    bool removeDoublets;
+    bool deletedFile;
+    bool liveSearch;
+    bool autorefresh;
+    qint64 undoBudget;          // In bytes
+    bool trigramIndex;          // Index the words for substring search when showing all
+    QString activeFont;
+    QString inactiveFont;
+    QRgb activeColor;
+    QRgb inactiveColor;
+    QRgb dueWarningColor;
+    QRgb dueLateColor;
+
+protected:
+    TodoSettings();
+    void load();
+};
+
+#endif // TODOSETTINGS_H
@@ -2,17 +2,286 @@
 #include "todotxt.h"
 #include "globals.h"
 #include "def.h"
+#include "todosettings.h"
 #include <QFont>
 #include <QColor>
-#include <QSettings>
 #include <QDebug>
+#include <QHash>
+#include <QDateTime>
+#include <QTimer>
+#include <algorithm>
 
-vector<QString> todo_data;
+#define MAX_ROW_MOVES 64 // More rows than this out of place and the view gets one layoutChanged instead
 
 TodoTableModel::TodoTableModel(QObject *parent) : QAbstractTableModel(parent)
 {
     todo = new todotxt();
     todo->parse();
+    settingsGeneration = TodoSettings::current().generation;
+    buildStyles();
+
+    // The rows are built here and after every change, never from inside data() or rowCount()
+    vector<int> ids;
+    todo->getRows(ids);
+    rows.resize(ids.size());
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        const todotxt::todotask &t = todo->getTask(ids[i]);
+        rows[i].id = t.id;
+        rows[i].key = t.key;
+        rows[i].inactive = t.inactive;
+    }
+
+    scheduleNewDay();
+}
+
+// Rows are told apart by the key of their line. A change in anything else on a row with the same text is a dataChanged
+bool TodoTableModel::sameDisplay(const rowEntry &r1, const rowEntry &r2)
+{
+    return r1.key == r2.key && r1.inactive == r2.inactive;
+}
+
+int TodoTableModel::sync()
+{
+    // If the settings changed, every row may look different even where the line is the same
+    const TodoSettings &settings = TodoSettings::current();
+    bool restyled = settingsGeneration != settings.generation;
+    if (restyled)
+    {
+        settingsGeneration = settings.generation;
+        generation++;
+        buildStyles();
+    }
+
+    vector<int> ids;
+    todo->getRows(ids);
+    vector<rowEntry> next(ids.size());
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+        const todotxt::todotask &t = todo->getTask(ids[i]);
+        next[i].id = t.id;
+        next[i].key = t.key;
+        next[i].inactive = t.inactive;
+    }
+
+    // rows is kept in step with the signals, so the views always see what they were told.
+    // The tasks have been rebuilt, so the ids of the rows are pointed at the new tasks before anything is signalled
+    int changedRow = -1;
+
+    // Most changes only touch a few rows, so skip the part at both ends that is the same
+    int start = 0;
+    int oldEnd = (int)rows.size();
+    int newEnd = (int)next.size();
+    while (start < oldEnd && start < newEnd && rows[start].key == next[start].key)
+    {
+        rows[start].id = next[start].id;
+        start++;
+    }
+    while (oldEnd > start && newEnd > start && rows[oldEnd - 1].key == next[newEnd - 1].key)
+    {
+        rows[oldEnd - 1].id = next[newEnd - 1].id;
+        oldEnd--;
+        newEnd--;
+    }
+
+    // Pair the old rows in the middle with new rows that have the same line, in order
+    QHash<quint64, vector<int>> wanted;
+    for (int j = newEnd - 1; j >= start; j--)
+        wanted[next[j].key].push_back(j); // Backwards, so that the first one is at the back
+    vector<int> match(oldEnd - start, -1);
+    vector<char> inserted(newEnd - start, 1);
+    int kept = 0;
+    for (int i = start; i < oldEnd; i++)
+    {
+        auto it = wanted.find(rows[i].key);
+        if (it != wanted.end() && !it.value().empty())
+        {
+            int j = it.value().back();
+            it.value().pop_back();
+            match[i - start] = j;
+            inserted[j - start] = 0;
+            rows[i].id = next[j].id;
+            kept++;
+        }
+        else
+        {
+            rows[i].id = -1; // On its way out
+        }
+    }
+
+    if (kept == 0 && oldEnd - start == newEnd - start && oldEnd > start)
+    {
+        // The rows were edited where they are, like a changed line that stays in place
+        for (int i = start; i < oldEnd; i++)
+            rows[i] = next[i];
+        emit dataChanged(index(start, 0), index(oldEnd - 1, 1));
+        changedRow = start;
+    }
+    else if (oldEnd > start || newEnd > start)
+    {
+        // Take away the rows that are gone, from the bottom so that the row numbers above stay valid
+        for (int i = oldEnd - 1; i >= start;)
+        {
+            if (match[i - start] >= 0)
+            {
+                i--;
+                continue;
+            }
+            int last = i;
+            while (i >= start && match[i - start] < 0)
+                i--;
+            beginRemoveRows(QModelIndex(), i + 1, last);
+            rows.erase(rows.begin() + i + 1, rows.begin() + last + 1);
+            endRemoveRows();
+        }
+        match.erase(std::remove(match.begin(), match.end(), -1), match.end());
+
+        // Where each of the rows that are left should end up among themselves
+        vector<int> order(match);
+        std::sort(order.begin(), order.end());
+        vector<int> target(kept);
+        for (int i = 0; i < kept; i++)
+            target[i] = (int)(std::lower_bound(order.begin(), order.end(), match[i]) - order.begin());
+
+        if (!std::is_sorted(target.begin(), target.end()))
+        {
+            // The rows that are in the longest increasing run of targets can stay where they are
+            vector<int> tails, tailIndex, previous(kept, -1);
+            for (int i = 0; i < kept; i++)
+            {
+                int pos = (int)(std::lower_bound(tails.begin(), tails.end(), target[i]) - tails.begin());
+                if (pos == (int)tails.size())
+                {
+                    tails.push_back(target[i]);
+                    tailIndex.push_back(i);
+                }
+                else
+                {
+                    tails[pos] = target[i];
+                    tailIndex[pos] = i;
+                }
+                previous[i] = pos > 0 ? tailIndex[pos - 1] : -1;
+            }
+            vector<char> placed(kept, 0);
+            for (int i = tailIndex.empty() ? -1 : tailIndex.back(); i >= 0; i = previous[i])
+                placed[i] = 1;
+
+            int moves = kept - (int)tails.size();
+            if (moves <= MAX_ROW_MOVES)
+            {
+                // Move each of the others in after the placed row with the closest smaller target. Going through
+                // the targets in order, every smaller target has been placed by then, so that is the row with target t - 1
+                vector<int> at(kept); // Where the row with each target is now
+                for (int i = 0; i < kept; i++)
+                    at[target[i]] = i;
+                for (int t = 0; t < kept; t++)
+                {
+                    int from = at[t];
+                    if (placed[from])
+                        continue;
+                    int to = t > 0 ? at[t - 1] + 1 : 0;
+                    if (to != from)
+                    {
+                        beginMoveRows(QModelIndex(), start + from, start + from, QModelIndex(), start + to);
+                        int dest = to > from ? to - 1 : to;
+                        rowEntry row = rows[start + from];
+                        rows.erase(rows.begin() + start + from);
+                        rows.insert(rows.begin() + start + dest, row);
+                        target.erase(target.begin() + from);
+                        target.insert(target.begin() + dest, t);
+                        placed.erase(placed.begin() + from);
+                        placed.insert(placed.begin() + dest, 1);
+                        for (int i = qMin(from, dest); i <= qMax(from, dest); i++)
+                            at[target[i]] = i; // Only the rows in between have shifted
+                        endMoveRows();
+                    }
+                    else
+                    {
+                        placed[from] = 1;
+                    }
+                }
+            }
+            else
+            {
+                // Too much has moved, like when the sort order changed. Rearrange everything in one go
+                emit layoutAboutToBeChanged();
+                QModelIndexList from = persistentIndexList();
+                QModelIndexList to;
+                vector<rowEntry> sorted(kept);
+                for (int i = 0; i < kept; i++)
+                    sorted[target[i]] = rows[start + i];
+                for (const QModelIndex &i : from)
+                {
+                    int r = i.row();
+                    if (r >= start && r < start + kept)
+                        r = start + target[r - start];
+                    to.append(index(r, i.column()));
+                }
+                std::copy(sorted.begin(), sorted.end(), rows.begin() + start);
+                changePersistentIndexList(from, to);
+                emit layoutChanged();
+            }
+        }
+
+        // Put in the new rows where they go
+        for (int j = start; j < newEnd;)
+        {
+            if (!inserted[j - start])
+            {
+                j++;
+                continue;
+            }
+            int first = j;
+            while (j < newEnd && inserted[j - start])
+                j++;
+            beginInsertRows(QModelIndex(), first, j - 1);
+            rows.insert(rows.begin() + first, next.begin() + first, next.begin() + j);
+            endInsertRows();
+            if (changedRow < 0)
+                changedRow = first;
+        }
+    }
+
+    // The rows now have the same lines in the same order as next. Tell the views about rows that
+    // look different even though the line is the same, like a task that became inactive
+    int run = -1;
+    int count = (int)next.size();
+    for (int i = 0; i <= count; i++)
+    {
+        bool differs = i < count && (restyled || !sameDisplay(rows[i], next[i]));
+        if (differs)
+            rows[i] = next[i]; // Drops what was cached for the row
+        if (differs && run < 0)
+        {
+            run = i;
+        }
+        else if (!differs && run >= 0)
+        {
+            emit dataChanged(index(run, 0), index(i - 1, 1));
+            run = -1;
+        }
+    }
+
+    return changedRow;
+}
+
+// Due dates are coloured relative to today, and thresholds may let new tasks through, so look again at midnight
+void TodoTableModel::scheduleNewDay()
+{
+    QDateTime now = QDateTime::currentDateTime();
+    QDateTime midnight(now.date().addDays(1), QTime(0, 0));
+    QTimer::singleShot(now.msecsTo(midnight) + 1000, this, SLOT(newDay()));
+}
+
+void TodoTableModel::newDay()
+{
+    // Whether a task is inactive is worked out when the tasks are built, so they are built again for the new date
+    generation++;
+    todo->rebuild();
+    sync();
+    if (!rows.empty())
+        emit dataChanged(index(0, 0), index((int)rows.size() - 1, 1));
+    scheduleNewDay();
 }
 
 TodoTableModel::~TodoTableModel()
@@ -23,13 +292,40 @@ TodoTableModel::~TodoTableModel()
 int TodoTableModel::rowCount(const QModelIndex &parent) const
 {
     Q_UNUSED(parent);
-    if (todo_data.empty())
-    {
-        QString temp;
-        todo->getAll(temp, todo_data);
-    }
-    int size = (int)todo_data.size();
-    return size;
+    return (int)rows.size();
+}
+
+QString TodoTableModel::rawAt(int row) const
+{
+    const todotxt::todotask *t = task(row);
+    if (t == NULL)
+        return QString();
+    return todo->rawLine(*t);
+}
+
+const todotxt::todotask *TodoTableModel::task(int row) const
+{
+    if (row >= (int)rows.size() || row < 0)
+        return NULL;
+    int id = rows[row].id;
+    if (id < 0 || id >= todo->taskCount())
+        return NULL;
+    return &todo->getTask(id);
+}
+
+shared_ptr<const todotxt::tagIndex> TodoTableModel::tagIndex()
+{
+    return todo->getTagIndex();
+}
+
+shared_ptr<const todotxt::wordIndex> TodoTableModel::wordIndex()
+{
+    return todo->getWordIndex();
+}
+
+int TodoTableModel::taskCount()
+{
+    return todo->taskCount();
 }
 
 QString TodoTableModel::getTodoFile()
@@ -37,106 +333,164 @@ QString TodoTableModel::getTodoFile()
     return todo->getTodoFilePath();
 }
 
+QString TodoTableModel::getDoneFile()
+{
+    return todo->getDoneFilePath();
+}
+
+bool TodoTableModel::changedOnDisk()
+{
+    return todo->changedOnDisk() || todo->doneChangedOnDisk();
+}
+
 int TodoTableModel::columnCount(const QModelIndex &parent) const
 {
     Q_UNUSED(parent);
     return 2;
 }
 
-QVariant TodoTableModel::data(const QModelIndex &index, int role) const
+void TodoTableModel::buildStyles()
 {
-    QSettings settings;
+    const TodoSettings &settings = TodoSettings::current();
 
-    if (!index.isValid())
-        return QVariant();
+    fonts.resize(fontVariants);
+    for (int i = 0; i < fontVariants; i++)
+    {
+        QFont f;
+        if (i & fontInactive)
+        {
+            f.fromString(settings.inactiveFont);
+        }
+        else
+        {
+            f.fromString(settings.activeFont);
+        }
+        f.setStrikeOut(i & fontDone); // Strike out if done
 
-    if (todo_data.empty())
+        if (i & fontUrl)
+        {
+            f.setUnderline(true);
+        }
+        fonts[i] = f;
+    }
+
+    colors.resize(colorVariants);
+    colors[colorActive] = QColor::fromRgba(settings.activeColor);
+    colors[colorInactive] = QColor::fromRgba(settings.inactiveColor);
+    colors[colorDueWarning] = QColor::fromRgba(settings.dueWarningColor);
+    colors[colorDueLate] = QColor::fromRgba(settings.dueLateColor);
+}
+
+// Works out everything data() can be asked for about a row. This is only done again when the row or the generation changes
+void TodoTableModel::fillCache(const rowEntry &r) const
+{
+    const TodoSettings &settings = TodoSettings::current();
+    const todotxt::todotask &task = todo->getTask(r.id);
+
+    r.display = todo->prettyLine(task);
+    r.check = task.checked ? Qt::Checked : Qt::Unchecked;
+    r.url = todo->getURL(task);
+
+    r.font = (task.inactive ? fontInactive : 0) | (task.checked ? fontDone : 0) | (task.urlStart >= 0 ? fontUrl : 0);
+
+    int due = todo->dueIn(task); // The settings check is done in the todo call
+    bool active = !task.checked;
+
+    if (active && due <= 0)
+    {
+        // We have passed due date
+        r.color = colorDueLate;
+    }
+    else if (active && due <= settings.dueWarning)
     {
-        QString temp;
-        todo->getAll(temp, todo_data);
+        r.color = colorDueWarning;
     }
+    else if (task.inactive)
+    {
+        r.color = colorInactive;
+    }
+    else
+    {
+        r.color = colorActive;
+    }
+
+    r.generation = generation;
+}
+
+QVariant TodoTableModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid())
+        return QVariant();
 
-    if (index.row() >= (int)todo_data.size() || index.row() < 0)
+    if (index.row() >= (int)rows.size() || index.row() < 0)
         return QVariant();
 
+    // Everything below is read from the cache of the row
+    const rowEntry &r = rows[index.row()];
+    if (r.generation != generation)
+    {
+        if (task(index.row()) == NULL)
+            return QVariant(); // A row that is being taken away
+        fillCache(r);
+    }
+
     if (role == Qt::DisplayRole || role == Qt::EditRole || role == Qt::ToolTipRole)
     {
         if (index.column() == 1)
         {
-            QString s = todo->prettyPrint((todo_data.at(index.row())));
-            return s;
+            return r.display;
         }
     }
 
     if (role == Qt::CheckStateRole)
     {
         if (index.column() == 0)
-            return todo->getState(todo_data.at(index.row()));
+            return r.check;
     }
 
     if (role == Qt::FontRole)
     {
         if (index.column() == 1)
         {
-            QFont f;
-            if (todo->isInactive(todo_data.at(index.row())))
-            {
-                f.fromString(settings.value(SETTINGS_INACTIVE_FONT).toString());
-            }
-            else
-            {
-                f.fromString(settings.value(SETTINGS_ACTIVE_FONT).toString());
-            }
-            f.setStrikeOut(todo->getState(todo_data.at(index.row()))); // Strike out if done
-
-            QString url = todo->getURL(todo_data.at(index.row()));
-            if (!url.isEmpty())
-            {
-                f.setUnderline(true);
-            }
-
-            return f;
+            return fonts[r.font];
         }
     }
 
     if (role == Qt::TextColorRole)
     {
-
-        int due = todo->dueIn(todo_data.at(index.row())); // The settings check is done in the todo call
-        bool active = true;
-        if (todo_data.at(index.row()).startsWith("x "))
-        {
-            active = false;
-        }
-
-        if (active && due <= 0)
-        {
-            // We have passed due date
-            return QVariant::fromValue(QColor::fromRgba(settings.value(SETTINGS_DUE_LATE_COLOR, DEFAULT_DUE_LATE_COLOR).toUInt()));
-        }
-        else if (active && due <= settings.value(SETTINGS_DUE_WARNING, DEFAULT_DUE_WARNING).toInt())
-        {
-            return QVariant::fromValue(QColor::fromRgba(settings.value(SETTINGS_DUE_WARNING_COLOR, DEFAULT_DUE_WARNING_COLOR).toUInt()));
-        }
-        else if (todo->isInactive(todo_data.at(index.row())))
-        {
-            return QVariant::fromValue(QColor::fromRgba(settings.value(SETTINGS_INACTIVE_COLOR, DEFAULT_INACTIVE_COLOR).toUInt()));
-        }
-        else
-        {
-            return QVariant::fromValue(QColor::fromRgba(settings.value(SETTINGS_ACTIVE_COLOR, DEFAULT_ACTIVE_COLOR).toUInt()));
-        }
+        return colors[r.color];
     }
 
     if (role == Qt::UserRole)
     {
         // This one returns the RAW value of the row
-        return todo_data.at(index.row());
+        return rawAt(index.row());
     }
 
     if (role == Qt::UserRole + 1)
     {
-        return todo->getURL(todo_data.at(index.row()));
+        return r.url;
+    }
+
+    if (role == StyleRole)
+    {
+        return generation * fontVariants + r.font;
+    }
+
+    if (role == SpansRole)
+    {
+        // Only asked for when the delegate lays out a row it has not seen, so this is not cached
+        const todotxt::todotask *t = task(index.row());
+        if (t == NULL)
+            return QVariant();
+        vector<todotxt::textSpan> found = todo->lineSpans(*t);
+        QVector<int> spans;
+        spans.reserve((int)found.size() * 3);
+        for (auto &s : found)
+        {
+            spans << s.start << s.length << s.kind;
+        }
+        return QVariant::fromValue(spans);
     }
 
     return QVariant();
@@ -162,22 +516,19 @@ QVariant TodoTableModel::headerData(int section, Qt::Orientation orientation, in
 
 bool TodoTableModel::setData(const QModelIndex &index, const QVariant &value, int role)
 {
-    setData(index, value, role, true);
-}
-
-bool TodoTableModel::setData(const QModelIndex &index, const QVariant &value, int role, bool shouldEndResetModel)
-{
+    // Inside a transaction the change only goes into the in-memory document. The views are told in commitTransaction()
+    bool inTransaction = todo->inTransaction();
     if (role == Qt::CheckStateRole)
     {
-        beginResetModel();
-        todo->update(todo_data.at(index.row()), value.toBool(), todo_data.at(index.row()));
+        QString row = rawAt(index.row());
+        todo->update(row, value.toBool(), row);
     }
     else if (role == Qt::EditRole)
     {
-        beginResetModel();
-        bool checked = true ? todo_data.at(index.row()).at(0) == 'x' : false;
+        QString row = rawAt(index.row());
+        bool checked = true ? row.at(0) == 'x' : false;
         QString s = value.toString();
-        todo->update(todo_data.at(index.row()), checked, s);
+        todo->update(row, checked, s);
     }
     else
     {
@@ -185,64 +536,66 @@ bool TodoTableModel::setData(const QModelIndex &index, const QVariant &value, in
         return false;
     }
 
-    if (shouldEndResetModel)
+    if (!inTransaction)
     {
-        todo_data.clear();
-        endResetModel(); // Can't call this if working in a batch list or it will segfault
+        int row = sync();
+        if (row >= 0)
+        {
+            // Detta innebär ju också att denna item är den som är selected just nu så vi kan lyssna på den signalen
+            emit edited(this->index(row, 0), this->index(row, 1));
+        }
     }
 
-    emit dataChanged(index, index); // Detta innebär ju också att denna item är den som är selected just nu så vi kan lyssna på den signalen
-
     return true;
 }
 
-bool TodoTableModel::toggleRow(const QModelIndex &index, bool shouldEndResetModel)
+bool TodoTableModel::toggleRow(const QModelIndex &index)
 {
-    bool newCheckedValue = todo_data.at(index.row()).at(0) == 'x' ? false : true;
+    bool newCheckedValue = rawAt(index.row()).at(0) == 'x' ? false : true;
     qDebug() << "New checked value" << newCheckedValue << "index:" << index;
-    return setData(index, newCheckedValue, Qt::CheckStateRole, shouldEndResetModel);
+    return setData(index, newCheckedValue, Qt::CheckStateRole);
 }
 
-void TodoTableModel::endReset()
+void TodoTableModel::beginTransaction()
 {
-    endResetModel();
+    todo->beginTransaction();
+}
+
+void TodoTableModel::commitTransaction()
+{
+    todo->commitTransaction();
+    if (!todo->inTransaction())
+    {
+        // All the changes are written with one write and one parse. Now let the view know.
+        sync();
+    }
 }
 
 void TodoTableModel::add(QString text)
 {
-    beginResetModel();
     QString temp;
     todo->update(temp, false, text.replace('\n', ' ')); // Make sure newlines don't get through as that would create multiple rows
-    todo_data.clear();
-    endResetModel();
+    if (!todo->inTransaction())
+        sync();
 }
 
-void TodoTableModel::remove(QString text, bool shouldEndResetModel)
+void TodoTableModel::remove(QString text)
 {
-    beginResetModel();
     todo->remove(text);
-
-    if (shouldEndResetModel)
-    {
-        todo_data.clear();
-        endResetModel(); // Can't call this if working in a batch list or it will segfault
-    }
+    if (!todo->inTransaction())
+        sync();
 }
 
 void TodoTableModel::archive()
 {
-    beginResetModel();
     todo->archive();
-    todo_data.clear();
-    endResetModel();
+    sync();
 }
 
 void TodoTableModel::refresh()
 {
-    beginResetModel();
     todo->refresh();
-    todo_data.clear();
-    endResetModel();
+    sync();
 }
 
 Qt::ItemFlags TodoTableModel::flags(const QModelIndex &index) const
@@ -267,6 +620,19 @@ QModelIndexList TodoTableModel::match(const QModelIndex &start, int role, const
     Q_UNUSED(hits);
     Q_UNUSED(flags);
     QModelIndexList ret;
+    if (role == Qt::UserRole)
+    {
+        // Compare the keys first, so that only rows that are most likely the line are made into text
+        QString text = value.toString();
+        quint64 key = todotxt::lineKey(text);
+        for (int i = 0; i < (int)this->rows.size(); i++)
+        {
+            if (this->rows[i].key == key && rawAt(i) == text)
+                ret.append(createIndex(i, 1));
+        }
+        return ret;
+    }
+
     int rows = this->rowCount(QModelIndex()); // Denna tar och laddar modellen också med data
     // Gå igenom alla rader och leta efter en exakt träff
     for (int i = 0; i < rows; i++)
@@ -284,12 +650,16 @@ QModelIndexList TodoTableModel::match(const QModelIndex &start, int role, const
 
 bool TodoTableModel::undo()
 {
-    return todo->undo();
+    bool ret = todo->undo();
+    sync();
+    return ret;
 }
 
 bool TodoTableModel::redo()
 {
-    return todo->redo();
+    bool ret = todo->redo();
+    sync();
+    return ret;
 }
 
 bool TodoTableModel::undoPossible()
@@ -2,6 +2,8 @@
 #define TODOTABLEMODEL_H
 
 #include <QAbstractTableModel>
+#include <QFont>
+#include <QColor>
 #include "todotxt.h"
 
 class TodoTableModel : public QAbstractTableModel
@@ -10,34 +12,84 @@ class TodoTableModel : public QAbstractTableModel
 protected:
     todotxt *todo;
 
+    // A row of the table. The key of the line and the inactive flag are what changes are worked out from. The rest
+    // is what data() hands out, filled in the first time it is asked for and again when generation moves on.
+    // The line itself is not kept, as rows from done.txt only have it while they are shown
+    struct rowEntry
+    {
+        int id = -1;                // The task in todo
+        quint64 key = 0;            // todotxt::lineKey() of the line
+        bool inactive = false;
+        mutable int generation = -1;
+        mutable QString display;
+        mutable unsigned char font = 0;  // Index in fonts
+        mutable unsigned char color = 0; // Index in colors
+        mutable Qt::CheckState check = Qt::Unchecked;
+        mutable QString url;
+    };
+    vector<rowEntry> rows;
+    int generation = 0;         // Bumped when everything has to be worked out again, like when the settings change
+    int settingsGeneration;     // The TodoSettings generation the cache was made with
+
+    // There are only a few ways a row can look, so those are made once per settings change and the rows
+    // refer to them. Kept as QVariants so that data() hands out a shared copy instead of a new font
+    enum { fontInactive = 1, fontDone = 2, fontUrl = 4, fontVariants = 8 }; // Font index is a combination of these
+    enum { colorActive, colorInactive, colorDueWarning, colorDueLate, colorVariants };
+    vector<QVariant> fonts;
+    vector<QVariant> colors;
+    void buildStyles();
+
+    int sync(); // Updates rows after a change and signals the views only what changed. Returns the first row that was changed or added, -1 if none
+    static bool sameDisplay(const rowEntry &r1, const rowEntry &r2);
+    void fillCache(const rowEntry &r) const;
+    QString rawAt(int row) const;
+    void scheduleNewDay();
+
 public:
+    // For the delegate that draws the text column
+    enum
+    {
+        StyleRole = Qt::UserRole + 2, // Changes whenever the same text would be drawn differently
+        SpansRole = Qt::UserRole + 3  // The spans of the task as start, length and kind, three ints per span
+    };
+
     explicit TodoTableModel(QObject *parent = 0);
     ~TodoTableModel();
     int rowCount(const QModelIndex &parent) const;
     int columnCount(const QModelIndex &parent) const;
     QVariant data(const QModelIndex &index, int role) const;
+    const todotxt::todotask *task(int row) const; // The record shown on a row, NULL if there is no such row
+    shared_ptr<const todotxt::tagIndex> tagIndex();
+    shared_ptr<const todotxt::wordIndex> wordIndex();
+    int taskCount();
     QVariant headerData(int section, Qt::Orientation orientation, int role) const;
     Qt::ItemFlags flags(const QModelIndex &index) const;
-    bool toggleRow(const QModelIndex &index, bool shouldEndResetModel = true);
+    bool toggleRow(const QModelIndex &index);
     bool setData(const QModelIndex &index, const QVariant &value, int role);
-    bool setData(const QModelIndex &index, const QVariant &value, int role, bool shouldEndResetModel = true);
     void add(QString text);
-    void remove(QString text, bool shouldEndResetModel = true);
+    void remove(QString text);
     void archive();
     void refresh();
     int count();
     QString getTodoFile();
+    QString getDoneFile();
+    bool changedOnDisk();
     QModelIndexList match(const QModelIndex &start, int role, const QVariant &value, int hits = 1, Qt::MatchFlags flags = Qt::MatchFlags(Qt::MatchStartsWith | Qt::MatchWrap)) const;
     bool undo();
     bool redo();
     bool undoPossible(); // Say if undo is possible or not
     bool redoPossible(); // Say if redo is possible or not
-    void endReset();
+    void beginTransaction(); // Batch up changes to many rows. They are written and shown on commitTransaction()
+    void commitTransaction();
 
 signals:
     //void dataChanged(QModelIndex i1,QModelIndex i2,QVector<int> v); Borde inte behövas. Det finns ju redan
+    void edited(QModelIndex i1, QModelIndex i2); // setData() changed a row. Points at where the row is now, as it may have moved
 
 public slots:
+
+protected slots:
+    void newDay();
 };
 
 #endif // TODOTABLEMODEL_H
@@ -6,107 +6,374 @@
 #include <QFile>
 #include <QTextStream>
 #include <QStringList>
+#include <QSet>
 #include <QDate>
 #include <set>
-#include <QSettings>
+#include <algorithm>
 #include <QRegularExpression>
 #include <QDebug>
-#include <QUuid>
-#include <QDir>
+#include <QFileInfo>
+#include <cstring>
 #include "def.h"
+#include "todosettings.h"
+#include "linescanner.h"
+
+#define SHOWN_LINES 1024 // Lines from done.txt to keep as QStrings once they have been shown
+#define WORD_SLACK 4096 // Words that no task has any more are kept up to this many, or as many as are used, before the word ids are given out again
 
 todotxt::todotxt()
 {
-    // This is part of the old implementation where we'd have a constant undoDir that could
-    // be shared by many applications.  I leave it here in case we end up with using too much storage
-    // and need manual cleanups.
-    //cleanupUndoDir();
-
-    undoDir = new QTemporaryDir();
-    if(!undoDir->isValid()){
-        qDebug()<<"Could not create undo dir"<<Qt::endl;
-    } else {
-        qDebug()<<"Created undo dir at "<<undoDir->path()<<Qt::endl;
-    }
+    shown.setMaxCost(SHOWN_LINES);
 }
 
 todotxt::~todotxt()
 {
-    if(undoDir)
-        delete undoDir;
 }
 
 void todotxt::setdirectory(QString &dir){
     filedirectory=dir;
 }
 
-static QRegularExpression regex_project("\\s(\\+[^\\s]+)");
-static QRegularExpression regex_context("\\s(\\@[^\\s]+)");
+static QRegularExpression regex_url("[a-zA-Z0-9_]+:\\/\\/([-a-zA-Z0-9@:%_\\+.~#?&\\/=\\(\\)\\{\\}\\\\]*)");
 
 void todotxt::parse(){
+    // Reads the files from disk. After this the in-memory document is what we work with and
+    // the files are only read again when they have been changed by someone else.
+    const TodoSettings &settings = TodoSettings::current();
+    //qDebug()<<"todotxt::parse";
+    vector<QString> ondisk;
+    readTodo(ondisk);
+    takeFromDisk(ondisk);
+
+    if(settings.showAll){
+        // Donefile as well. It is only read again if someone else has changed it
+        if(!doneLoaded || doneChangedOnDisk())
+            loadDone();
+    } else if(doneLoaded){
+        done.clear();
+        doneLoaded=false;
+        doneVersion++;
+    }
 
-    // Before we do anything here, we make sure we have covered our bases with an undo save
-    // Note, that except for the first read, if we end up doing a save here, something has changed on disk
-    // outside of this program.
-    saveToUndo();
+    buildTasks();
+}
 
-    QSettings settings;
-    //qDebug()<<"todotxt::parse";
-    // parse the files todo.txt and done.txt (for now only todo.txt)
-    todo.clear();
-    active_contexts.clear();
-    active_projects.clear();
-    QString todofile=getTodoFilePath();
+void todotxt::buildTasks(){
+    const TodoSettings &settings = TodoSettings::current();
+
+    // Build the task records once so that nobody has to run the regexes on the lines again.
+    // The records of lines that are still there are kept, so after an edit, or a sync client adding a
+    // line, only the lines that are new get parsed. Lines are found again by their key, and keep their id
+    bool reuse = parsedGeneration==settings.generation; // Parsing depends on the settings
+    parsedGeneration = settings.generation;
+    vector<int> added;
+    vector<int> removed;
+    if(!reuse){
+        removed.swap(todoIds);
+        removed.insert(removed.end(),doneIds.begin(),doneIds.end());
+        doneIds.clear();
+    }
+    QHash<quint64,vector<int>> previous;
+    for(int i=(int) todoIds.size()-1;i>=0;i--)
+        previous[tasks[todoIds[i]].key].push_back(todoIds[i]); // Backwards, so that the first one is at the back
+
+    vector<int> ids;
+    ids.reserve(todo.size());
+    for(auto &line : todo){
+        auto it = previous.find(lineKey(line));
+        if(it!=previous.end() && !it.value().empty() && tasks[it.value().back()].raw==line){
+            ids.push_back(it.value().back());
+            it.value().pop_back();
+            continue;
+        }
+        int id = newTask();
+        parseTask(line,tasks[id]);
+        added.push_back(id);
+        ids.push_back(id);
+    }
+    for(auto &left : previous)
+        removed.insert(removed.end(),left.begin(),left.end());
+    todoIds.swap(ids);
+
+    // The lines of done.txt only keep what sorting, searching and the indexes need. The text is
+    // made again from done when a line is shown. done is only added to until it is read again,
+    // so the records are kept unless that happened, and only the lines added since are parsed
+    bool sameDone = reuse && builtDone==doneVersion && (int) doneIds.size()<=done.size();
+    builtDone = doneVersion;
+    if(!sameDone){
+        shown.clear();
+        removed.insert(removed.end(),doneIds.begin(),doneIds.end());
+        doneIds.clear();
+    }
+    for(int i=(int) doneIds.size();i<done.size();i++){
+        int id = newTask();
+        todotask &t = tasks[id];
+        QString line = done.at(i);
+        parseTask(line,t);
+        t.line = i;
+        t.raw = QString();
+        t.pretty = QString();
+        t.projects.clear();
+        t.contexts.clear();
+        vector<textSpan>().swap(t.spans);
+        added.push_back(id);
+        doneIds.push_back(id);
+    }
 
-    slurp(todofile,todo);
-
-    if(settings.value(SETTINGS_SHOW_ALL,DEFAULT_SHOW_ALL).toBool()){
-        // Donefile as well
-        QString donefile = getDoneFilePath();
-        slurp(donefile,todo);
-    }
-
-      if(settings.value(SETTINGS_THRESHOLD_LABELS).toBool()){
-          // Get all active tags with either a @ or a + sign infront of them, as they can be used for thresholds
-          foreach (auto line, todo) {
-              if(line.startsWith("x ")){
-                  continue; // Inactive so we don't care
-              } else {
-                auto matches = regex_project.globalMatch(line);
-                while(matches.hasNext()){
-                    auto match = matches.next();
-                    auto project = match.captured(1);
-                    active_projects.insert(project);
-                }
-                matches = regex_context.globalMatch(line);
-                while(matches.hasNext()){
-                    auto match = matches.next();
-                    active_contexts.insert(match.captured(1));
-                }
-              }
+    // Mark all the tags of open tasks in todo.txt as active, as they can be used for thresholds
+    activeTags.assign(tagCount,0);
+    if(settings.thresholdLabels){
+        for(int id : todoIds){
+            if(tasks[id].raw.startsWith("x ")){
+                continue; // Inactive so we don't care
+            }
+            for(int tag : tasks[id].tagIds)
+                activeTags[tag]=1;
+        }
+    }
+
+    // Whether a task is inactive depends on the active tags, so this can only be done once they are all known
+    for(int id : todoIds)
+        tasks[id].inactive = isInactive(tasks[id]);
+    for(int id : doneIds)
+        tasks[id].inactive = isInactive(tasks[id]);
+
+    updateIndexes(added,removed);
 
-          }
-      }
+    // The records of the lines that are gone are only let go of once nothing refers to them
+    for(int id : removed){
+        tasks[id] = todotask();
+        tasks[id].id = -1;
+        freeIds.push_back(id);
+    }
+}
+
+int todotxt::newTask(){
+    int id;
+    if(freeIds.empty()){
+        id = (int) tasks.size();
+        tasks.emplace_back();
+    } else {
+        id = freeIds.back();
+        freeIds.pop_back();
+    }
+    tasks[id].id = id;
+    return id;
+}
+
+// Adds the added tasks to the lists of the ids that field gives for them, and takes the removed ones out.
+// Only the lists that are touched are copied, see postingLists
+static void patchLists(postingLists &lists,const vector<todotxt::todotask> &tasks,const vector<int> &added,const vector<int> &removed,vector<int> todotxt::todotask::*field){
+    QHash<int,pair<vector<int>,vector<int>>> changes; // For each list, the tasks that come in and go out
+    for(int id : added){
+        for(int list : tasks[id].*field)
+            changes[list].first.push_back(id);
+    }
+    for(int id : removed){
+        for(int list : tasks[id].*field)
+            changes[list].second.push_back(id);
+    }
+    for(auto it=changes.begin();it!=changes.end();it++){
+        for(vector<int> *ids : {&it.value().first,&it.value().second}){
+            std::sort(ids->begin(),ids->end());
+            ids->erase(std::unique(ids->begin(),ids->end()),ids->end()); // A word can be in a line more than once
+        }
+        lists.update(it.key(),it.value().first,it.value().second);
+    }
+}
+
+// Fills empty lists from all the tasks that are in use
+static void fillLists(postingLists &lists,const vector<todotxt::todotask> &tasks,const vector<char> &used,vector<int> todotxt::todotask::*field){
+    for(size_t id=0;id<tasks.size();id++){
+        if(!used[id])
+            continue;
+        for(int list : tasks[id].*field)
+            lists.push(list,(int) id); // Ascending, as the ids are
+    }
+}
+
+void todotxt::updateIndexes(const vector<int> &added,const vector<int> &removed){
+    // Patching the lists is only worth it while few tasks have changed. After a reload or a change of
+    // settings most of them have, and making the lists again is cheaper than that many updates
+    size_t live = todoIds.size()+doneIds.size();
+    bool patch = tags && added.size()+removed.size()<=live/2;
+    shared_ptr<tagIndex> index;
+    if(patch){
+        index = make_shared<tagIndex>(*tags);
+    } else {
+        index = make_shared<tagIndex>();
+        for(int id=0;tags && id<tags->size();id++)
+            index->append(tags->name(id),tags->lower(id)); // The names are kept, so they aren't lower-cased again
+    }
+    for(auto &name : newTags)
+        index->append(name,name.toLower());
+    newTags.clear();
+
+    vector<char> used(tasks.size(),0);
+    for(int id : todoIds)
+        used[id]=1;
+    for(int id : doneIds)
+        used[id]=1;
+    if(patch)
+        patchLists(*index,tasks,added,removed,&todotask::tagIds);
+    else
+        fillLists(*index,tasks,used,&todotask::tagIds);
+    tags = index;
+
+    // The same for the words. A word is its own lower case, as the text is lower-cased before it is split
+    shared_ptr<wordIndex> w;
+    if(patch && words){
+        w = make_shared<wordIndex>(*words);
+    } else {
+        w = make_shared<wordIndex>();
+        for(int id=0;words && id<words->size();id++)
+            w->append(words->name(id),words->name(id));
+        w->epoch = words ? words->epoch : 0;
+    }
+    for(auto &name : newWords)
+        w->append(name,name);
+    newWords.clear();
+    if(patch && words)
+        patchLists(*w,tasks,added,removed,&todotask::words);
+    else
+        fillLists(*w,tasks,used,&todotask::words);
+
+    // Words that are edited away stay in the dictionary. Once most of it is those, start it over
+    if(w->unused()>WORD_SLACK && w->unused()>w->size()-w->unused())
+        w = compactWords(*w);
+    words = w;
+}
+
+shared_ptr<todotxt::wordIndex> todotxt::compactWords(const wordIndex &index){
+    vector<int> remap(index.size(),-1);
+    auto w = make_shared<wordIndex>();
+    w->epoch = index.epoch+1;
+    wordIds.clear();
+    for(int id=0;id<index.size();id++){
+        if(index.tasks(id).empty())
+            continue;
+        remap[id] = w->size();
+        wordIds.insert(index.name(id),w->size());
+        w->append(index.name(id),index.name(id),index.tasks(id));
+    }
+    wordCount = w->size();
+
+    // Every word of a task that is there has a task, so it has a new id
+    for(int id : todoIds){
+        for(int &word : tasks[id].words)
+            word = remap[word];
+    }
+    for(int id : doneIds){
+        for(int &word : tasks[id].words)
+            word = remap[word];
+    }
+    return w;
+}
+
+// The word ids of the lower-cased pretty text
+void todotxt::findWords(todotask &t,const QString &text){
+    t.words.clear();
+    int start = -1;
+    for(int i=0;i<=text.length();i++){
+        if(i<text.length() && !text.at(i).isSpace()){
+            if(start<0)
+                start=i;
+        } else if(start>=0){
+            t.words.push_back(internWord(text.mid(start,i-start)));
+            start=-1;
+        }
+    }
+}
+
+int todotxt::internWord(const QString &word){
+    auto it = wordIds.constFind(word);
+    if(it!=wordIds.constEnd())
+        return it.value();
+    int id = wordCount++;
+    wordIds.insert(word,id);
+    newWords.push_back(word);
+    return id;
+}
+
+shared_ptr<const todotxt::wordIndex> todotxt::getWordIndex(){
+    if(!words)
+        return make_shared<wordIndex>();
+    return words;
+}
+
+int todotxt::internTag(const QString &tag){
+    auto it = tagIds.constFind(tag);
+    if(it!=tagIds.constEnd())
+        return it.value();
+    int id = tagCount++;
+    tagIds.insert(tag,id);
+    newTags.push_back(tag);
+    return id;
+}
+
+int todotxt::findTag(const QString &tag){
+    return tagIds.value(tag,-1);
+}
+
+shared_ptr<const todotxt::tagIndex> todotxt::getTagIndex(){
+    if(!tags)
+        return make_shared<tagIndex>();
+    return tags;
+}
+
+int todotxt::taskCount(){
+    return (int) tasks.size();
+}
+
+// The tag panel has always shown a tag as far as its letters, digits and -:/.@ go, so that "+proj," is counted as "+proj"
+static QString panelName(const QString &tag){
+    int n=1;
+    while(n<tag.length()){
+        ushort u=tag.at(n).unicode();
+        bool keep=(u>='a' && u<='z') || (u>='A' && u<='Z') || (u>='0' && u<='9') || u=='-' || u==':' || u=='/' || u=='.' || u=='@';
+        if(!keep)
+            break;
+        n++;
+    }
+    return tag.left(n);
+}
+
+void todotxt::countTags(const tagIndex &index,const vector<int> &ids,int taskCount,map<QString,int> &counts){
+    // Mark the ids once, then each posting list is intersected with them by looking up its entries
+    vector<char> in(taskCount,0);
+    for(int id : ids){
+        if(id>=0 && id<taskCount)
+            in[id]=1;
+    }
+    for(int tag=0;tag<index.size();tag++){
+        int n=0;
+        for(int id : index.tasks(tag)){
+            if(id<taskCount && in[id])
+                n++;
+        }
+        if(n==0)
+            continue;
+        QString name=panelName(index.name(tag));
+        if(name.length()>1)
+            counts[name]+=n;
+    }
 }
 
 QString todotxt::getTodoFilePath(){
-    QSettings settings;
-    QString dir = settings.value(SETTINGS_DIRECTORY).toString();
+    QString dir = TodoSettings::current().directory;
     QString todofile = dir.append(TODOFILE);
     return todofile;
 }
 
 
 QString todotxt::getDoneFilePath(){
-    QSettings settings;
-    QString dir = settings.value(SETTINGS_DIRECTORY).toString();
+    QString dir = TodoSettings::current().directory;
     QString todofile = dir.append(DONEFILE);
     return todofile;
 }
 
 QString todotxt::getDeletedFilePath(){
-    QSettings settings;
-    QString dir = settings.value(SETTINGS_DIRECTORY).toString();
+    QString dir = TodoSettings::current().directory;
     QString todofile = dir.append(DELETEDFILE);
     return todofile;
 }
@@ -123,59 +390,59 @@ void todotxt::getActive(QString& filter,vector<QString> &output){
 
 
 bool todotxt::isInactive(QString &text){
-    QSettings settings;
-    QString t=settings.value(SETTINGS_INACTIVE).toString();
-    if(t.isEmpty())
+    const TodoSettings &settings = TodoSettings::current();
+    if(settings.inactives.isEmpty())
         return false;
-    QStringList inactives = t.split(";");
+    const QStringList &inactives = settings.inactives;
     for(int i=0;i<inactives.count();i++){
         if(text.contains(inactives[i])){
             return true;
         }
     }
 
-    if(settings.value(SETTINGS_THRESHOLD_INACTIVE).toBool()){
+    if(settings.thresholdInactive){
         return threshold_hide(text);
     }
 
     return false;
 }
 
-/* Comparator function.. We need to remove all the junk in the beginning of the line */
-bool todotxt::lessThan(QString &s1,QString &s2){
-    QString w1 = s1.split(" ").at(0);
-    QString w2 = s2.split(" ").at(0);
-
-    if (w1.toLower() < prettyPrint(w2).toLower())
-    {
+bool todotxt::isInactive(const todotask &t){
+    const TodoSettings &settings = TodoSettings::current();
+    if(settings.inactives.isEmpty())
+        return false;
+    if(t.marked){
         return true;
     }
-    else if (prettyPrint(w1).toLower() > prettyPrint(w2).toLower())
-    {
-        return false;
+
+    if(settings.thresholdInactive){
+        return threshold_hide(t);
     }
 
-    auto s1date = dateFrom(s1);
-    auto s2date = dateFrom(s2);
+    return false;
+}
 
-    if (!s1date.isNull() && s2date.isNull())
-    {
-        return true;
-    }
-    else if (s1date.isNull() && !s2date.isNull())
-    {
-        return false;
-    }
-    else if (!s1date.isNull() && !s2date.isNull() && s1date < s2date)
-    {
-        return true;
-    }
-    else if (!s1date.isNull() && !s2date.isNull() && s1date > s2date)
-    {
-        return false;
+/* Comparator function. Compares the sort keys that parseTask() made, so we don't have to remove all the junk in the beginning of the line here */
+bool todotxt::taskLessThan(const todotask &t1,const todotask &t2) const{
+    int c = t1.sortWord.compare(t2.sortWord);
+    if(c!=0)
+        return c<0;
+
+    // Tasks with a due date go before those without, earliest first
+    if(t1.sortDue != t2.sortDue)
+        return t1.sortDue < t2.sortDue;
+
+    // Then the lower-cased text, a word at a time. Space sorts before anything in a word, so this is the same
+    // as comparing the text, apart from how much space there is, and no task has to keep its text for it
+    size_t n = std::min(t1.words.size(),t2.words.size());
+    for(size_t i=0;i<n;i++){
+        if(t1.words[i]==t2.words[i])
+            continue;
+        c = words->name(t1.words[i]).compare(words->name(t2.words[i]));
+        if(c!=0)
+            return c<0;
     }
-
-    return prettyPrint(s1).toLower() < prettyPrint(s2).toLower();
+    return t1.words.size() < t2.words.size();
 }
 
 static QRegularExpression regex_threshold_date("t:(\\d\\d\\d\\d-\\d\\d-\\d\\d)");
@@ -184,8 +451,8 @@ static QRegularExpression regex_threshold_context("t:(\\@[^\\s]+)");
 static QRegularExpression regex_due_date("due:(\\d\\d\\d\\d-\\d\\d-\\d\\d)");
 
 bool todotxt::threshold_hide(QString &t){
-    QSettings settings;
-    if(settings.value(SETTINGS_THRESHOLD).toBool()){
+    const TodoSettings &settings = TodoSettings::current();
+    if(settings.threshold){
         auto matches=regex_threshold_date.globalMatch(t);
         while(matches.hasNext()){
             QString today = getToday();
@@ -198,64 +465,87 @@ bool todotxt::threshold_hide(QString &t){
     }
 
 
-    if(settings.value(SETTINGS_THRESHOLD_LABELS).toBool()){
+    if(settings.thresholdLabels){
         auto matches=regex_threshold_project.globalMatch(t);
         while(matches.hasNext()){
-            QString project = matches.next().captured(1);
-            if(active_projects.count(project)==1)
+            int id = findTag(matches.next().captured(1));
+            if(id>=0 && id<(int)activeTags.size() && activeTags[id])
                 return true; // There is an active project with this name, so we skip this
         }
 
         matches=regex_threshold_context.globalMatch(t);
         while(matches.hasNext()){
-            QString project = matches.next().captured(1);
-            if(active_contexts.count(project)==1)
+            int id = findTag(matches.next().captured(1));
+            if(id>=0 && id<(int)activeTags.size() && activeTags[id])
                 return true; // There is an active project with this name, so we skip this
         }
     }
     return false;
 }
 
+// The same as above, but on the dates and tag ids that parseTask() already found
+bool todotxt::threshold_hide(const todotask &t){
+    const TodoSettings &settings = TodoSettings::current();
+    if(settings.threshold){
+        if(t.thresholdDate > QDate::currentDate().toJulianDay()){
+            return true; // Don't show this one since it's in the future
+        }
+    }
 
-void todotxt::getAll(QString& filter,vector<QString> &output){
-        // Vectors are probably not the best here...
-    Q_UNUSED(filter);
-        vector<QString> prio;
-        vector<QString> open;
-        vector<QString> done;
-        vector<QString> inactive;
-        QSettings settings;
-        QString t=settings.value(SETTINGS_INACTIVE).toString();
-        QStringList inactives = t.split(";");
-        if(!t.contains(";")){
-            // There is really nothing here but inactives will still have one item. Lets just remove it
-            inactives.clear();
+    if(settings.thresholdLabels){
+        for(int id : t.thresholdTags){
+            if(id<(int)activeTags.size() && activeTags[id])
+                return true; // There is an active project or context with this name, so we skip this
         }
+    }
+    return false;
+}
 
-        bool separateinactives = settings.value(SETTINGS_SEPARATE_INACTIVES).toBool();
 
-        for(vector<QString>::iterator iter=todo.begin();iter!=todo.end();iter++){
-            QString line = (*iter); // For debugging
-            if(line.isEmpty())
+void todotxt::getAll(QString& filter,vector<todotask> &output){
+    Q_UNUSED(filter);
+    vector<int> ids;
+    getRows(ids);
+    output.reserve(output.size()+ids.size());
+    for(int id : ids)
+        output.push_back(tasks[id]);
+}
+
+const todotxt::todotask &todotxt::getTask(int id){
+    return tasks.at(id);
+}
+
+void todotxt::getRows(vector<int> &output){
+        // Vectors are probably not the best here...
+        // The sections hold task ids so that sorting only moves integers around
+        vector<int> prio;
+        vector<int> open;
+        vector<int> done;
+        vector<int> inactive;
+        const TodoSettings &settings = TodoSettings::current();
+        // Without a ; there is really nothing in the markers, even if inactives will still have one item
+        bool markers = settings.inactive.contains(";");
+
+        bool separateinactives = settings.separateInactives;
+
+        // todo.txt first, then done.txt, the way they are in the files
+        size_t lines = todoIds.size()+doneIds.size();
+        for(size_t n=0;n<lines;n++){
+            const todotask &task = tasks[n<todoIds.size() ? todoIds[n] : doneIds[n-todoIds.size()]];
+            char section = task.section;
+            if(section==0)
                 continue;
 
             // Begin by checking for inactive, as there are two different ways of sorting those
-            bool inact=false;
-            for(int i=0;i<inactives.count();i++){
-                if((*iter).contains(inactives[i])){
-                    inact=true;
-                    break;
-
-                }
-            }
+            bool inact = markers && task.marked;
 
             // If we are respecting thresholds, we should check for that
-            bool no_show_threshold = threshold_hide((*iter));
+            bool no_show_threshold = threshold_hide(task);
 
 
             if (no_show_threshold)
             {
-                if (settings.value(SETTINGS_THRESHOLD_INACTIVE).toBool())
+                if (settings.thresholdInactive)
                 {
                     inact=true;
                 } else {
@@ -264,43 +554,41 @@ void todotxt::getAll(QString& filter,vector<QString> &output){
             }
 
 
-            if (settings.value(SETTINGS_SORT_ALPHA).toBool()
+            if (settings.sortAlpha
                     && !(inact&&separateinactives)
-                    && (*iter).at(0) == '(' && (*iter).at(2) == ')')
+                    && section == '(')
             {
-                prio.push_back((*iter));
+                prio.push_back(task.id);
             }
-            else if ( (*iter).at(0) == 'x')
+            else if (section == 'x')
             {
-                done.push_back((*iter));
+                done.push_back(task.id);
             }
             else if (inact)
             {
-                inactive.push_back((*iter));
+                inactive.push_back(task.id);
             }
             else
             {
-                open.push_back((*iter));
+                open.push_back(task.id);
             }
         }
 
         // Sort the open and done sections alphabetically if needed
 
-        if(settings.value(SETTINGS_SORT_ALPHA).toBool()){
-            std::sort(prio.begin(),prio.end(),lessThan);
-            std::sort(open.begin(),open.end(),lessThan);
-            std::sort(inactive.begin(),inactive.end(),lessThan);
-            std::sort(done.begin(),done.end(),lessThan);
+        if(settings.sortAlpha){
+            auto cmp = [this](int t1,int t2){ return taskLessThan(tasks[t1],tasks[t2]); };
+            std::sort(prio.begin(),prio.end(),cmp);
+            std::sort(open.begin(),open.end(),cmp);
+            std::sort(inactive.begin(),inactive.end(),cmp);
+            std::sort(done.begin(),done.end(),cmp);
         }
 
-        for(vector<QString>::iterator iter=prio.begin();iter!=prio.end();iter++)
-            output.push_back((*iter));
-        for(vector<QString>::iterator iter=open.begin();iter!=open.end();iter++)
-            output.push_back((*iter));
-        for(vector<QString>::iterator iter=inactive.begin();iter!=inactive.end();iter++)
-            output.push_back((*iter));
-        for(vector<QString>::iterator iter=done.begin();iter!=done.end();iter++)
-            output.push_back((*iter));
+        output.reserve(output.size()+prio.size()+open.size()+inactive.size()+done.size());
+        output.insert(output.end(),prio.begin(),prio.end());
+        output.insert(output.end(),open.begin(),open.end());
+        output.insert(output.end(),inactive.begin(),inactive.end());
+        output.insert(output.end(),done.begin(),done.end());
 }
 
 Qt::CheckState todotxt::getState(QString& row){
@@ -354,57 +642,41 @@ QString todotxt::getRelativeDate(QString shortform,QDate d){
 }
 
 
-void todotxt::restoreFiles(QString namePrefix){
-    qDebug()<<"Restoring: "<<namePrefix<<Qt::endl;
-    qDebug()<<"Pointer: "<<undoPointer<<Qt::endl;
-    // Copy back files from the undo
-    QString newtodo = namePrefix+TODOFILE;
-    QString newdone = namePrefix+DONEFILE;
-    QString newdeleted = namePrefix+DELETEDFILE;
-
-    if(QFile::exists(newtodo)){
-        QFile::remove(getTodoFilePath());
-        QFile::copy(newtodo,getTodoFilePath());
-    }
-    if(QFile::exists(newdone)){
-        QFile::remove(getDoneFilePath());
-        QFile::copy(newdone,getDoneFilePath());
-    }
-    if(QFile::exists(newdeleted)){
-        QFile::remove(getDeletedFilePath());
-        QFile::copy(newdeleted,getDeletedFilePath());
-    }
-
-}
 bool todotxt::undo()
 {
+    // Something else may have written todo.txt before the watcher told us. That becomes the latest step, the same as
+    // when parse() finds it
+    bool reloaded = reloadIfChanged();
+
     // Check if we can
-    if((int) undoBuffer.size()>undoPointer+1){
-        // yep. there is more in the buffer.
-        // Ok. Here it is obvious that I should have implemented undoBuffer as a vector and probably have the pointer to be a negative index
-        undoPointer++;
-        restoreFiles(undoBuffer[undoBuffer.size()-(1+undoPointer)]);
-        return true;
+    if(!undoPossible()){
+        if(reloaded)
+            buildTasks();
+        return false;
     }
-    return false;
+    undoPointer++;
+    applyUndo(undoJournal[undoJournal.size()-undoPointer],false);
+    return true;
 }
 
 bool todotxt::redo()
 {
+    bool reloaded = reloadIfChanged(); // Which leaves nothing to redo, as with any other new change
+
     // Check if we can
-    if(undoPointer>0){
-        // yep. there is more in the buffer.
-        // Ok. Here it is obvious that I should have implemented undoBuffer as a vector and probably have the pointer to be a negative index
-        undoPointer--;
-        restoreFiles(undoBuffer[undoBuffer.size()-(1+undoPointer)]);
-        return true;
+    if(!redoPossible()){
+        if(reloaded)
+            buildTasks();
+        return false;
     }
-    return false;
+    applyUndo(undoJournal[undoJournal.size()-undoPointer],true);
+    undoPointer--;
+    return true;
 }
 
 bool todotxt::undoPossible()
 {
-    if((int) undoBuffer.size()>undoPointer+1){
+    if(undoPointer<(int) undoJournal.size()){
         return true;
     }
     return false;
@@ -418,127 +690,353 @@ bool todotxt::redoPossible()
     return false;
 }
 
-QString todotxt::getUndoDir()
+void todotxt::recordOp(undoOp op)
 {
-    if(undoDir->isValid()){
-        return undoDir->path()+"/";
+    pendingOps.push_back(op);
+}
+
+#define MAX_DIFF_EDITS 1000 // A change bigger than this is recorded as all of the lines between the first and last change
+
+// The shortest edit script from a to b (Myers). Lines are compared by their keys. Returns false if it takes more than maxEdits
+// lines, otherwise script has 'k' for a line that is kept, 'd' for a line of a that is removed and 'i' for a line of b that is inserted
+static bool diffLines(const vector<quint64> &a,const vector<quint64> &b,int maxEdits,vector<char> &script){
+    int n = (int) a.size();
+    int m = (int) b.size();
+    int limit = std::min(n+m,maxEdits);
+    vector<int> v(2*limit+3,0);
+    int offset = limit+1;
+    vector<vector<int>> trace; // v for k in -d..d after each d, to walk back through
+    int d;
+    bool reached = false;
+    for(d=0;d<=limit && !reached;d++){
+        for(int k=-d;k<=d;k+=2){
+            int x;
+            if(k==-d || (k!=d && v[offset+k-1]<v[offset+k+1]))
+                x = v[offset+k+1];    // Down, inserting b[y]
+            else
+                x = v[offset+k-1]+1;  // Right, removing a[x]
+            int y = x-k;
+            while(x<n && y<m && a[x]==b[y]){
+                x++;
+                y++;
+            }
+            v[offset+k] = x;
+            if(x>=n && y>=m)
+                reached = true;
+        }
+        trace.emplace_back(v.begin()+offset-d,v.begin()+offset+d+1);
     }
+    if(!reached)
+        return false;
 
-    // The below code is backup for undo directory created in the same folder
-    // in case there was a problem with getting a temp directory (shouldn't happen.. but)
-    QSettings settings;
-    QString uuid = settings.value(SETTINGS_UUID,DEFAULT_UUID).toString();
-    QString dirbase = settings.value(SETTINGS_DIRECTORY).toString();
-    QString dir = dirbase+".todour_undo_"+uuid+"/";
-    // Check that the dir exists
-    QDir directory = QDir(dir);
-    if(!directory.exists()){
-        directory.mkdir(dir);
+    script.clear();
+    int x = n;
+    int y = m;
+    for(d=(int) trace.size()-1;d>0;d--){
+        const vector<int> &prev = trace[d-1];
+        auto at=[&](int k){ return prev[k+d-1]; };
+        int k = x-y;
+        int prevK = (k==-d || (k!=d && at(k-1)<at(k+1))) ? k+1 : k-1;
+        int prevX = at(prevK);
+        int prevY = prevX-prevK;
+        while(x>prevX && y>prevY){
+            script.push_back('k');
+            x--;
+            y--;
+        }
+        script.push_back(prevK==k+1 ? 'i' : 'd');
+        x = prevX;
+        y = prevY;
     }
-    return dir;
+    while(x>0 && y>0){
+        script.push_back('k');
+        x--;
+        y--;
+    }
+    std::reverse(script.begin(),script.end());
+    return true;
 }
 
-QString todotxt::getNewUndoNameDirAndPrefix()
+void todotxt::recordDiff(vector<QString> &before,vector<QString> &after)
 {
-    // Make a file path that is made to have _todo.txt or _done.txt appended to it
-    // We want the name to be anything that doesn't crash with any other. This can be linear numbering or just an UUID
-    // For now it's UUID but a linear numbering (with a solution to multiple clients running with the same undo-directory) would make
-    // more sense and be easier to follow for end-users in case they are looking through the files.
-    return getUndoDir()+QUuid::createUuid().toString()+"_";
-}
+    // Only the lines between the common beginning and end are looked at.
+    // That is what a sync client appending or changing a few lines looks like.
+    int start=0;
+    int beforeEnd=(int) before.size();
+    int afterEnd=(int) after.size();
+    while(start<beforeEnd && start<afterEnd && before[start]==after[start])
+        start++;
+    while(beforeEnd>start && afterEnd>start && before[beforeEnd-1]==after[afterEnd-1]){
+        beforeEnd--;
+        afterEnd--;
+    }
 
-void todotxt::cleanupUndoDir()
-{
-    // Go through the directory and remove everything that is older than 14 days old.
-    // Why 14 days? Because. That's why :)
-    // (I simply don't think this is interesting to have configurable.. But simple enough to do in case needed)
-    QDir directory(getUndoDir());
-    QStringList files = directory.entryList(QDir::Files);
-    QDateTime expirationTime = QDateTime::currentDateTime();
-    expirationTime = expirationTime.addDays(-14);
-    qDebug()<<"Checking for undo files to cleanup..."<<Qt::endl;
-    foreach(QString filename, files) {
-        auto finfo = QFileInfo(directory.filePath(filename));
-        QDateTime created = finfo.birthTime();
-        if(expirationTime.daysTo(created)<0 || !created.isValid()){
-            //qDebug()<<"We should remove file (but wont now)"<<filename<<Qt::endl;
-            if(!QFile::remove(directory.filePath(filename))){
-                qDebug()<<"Failed to remove: "<<filename<<Qt::endl;
+    // Within that, only the lines that were removed or added are recorded, not the ones in between
+    vector<quint64> a,b;
+    for(int i=start;i<beforeEnd;i++)
+        a.push_back(lineKey(before[i]));
+    for(int i=start;i<afterEnd;i++)
+        b.push_back(lineKey(after[i]));
+    vector<char> script;
+    if(diffLines(a,b,MAX_DIFF_EDITS,script)){
+        int pos=start; // In the document as the ops so far have left it
+        int i=start;
+        int j=start;
+        for(char c : script){
+            if(c=='k'){
+                pos++;
+                i++;
+                j++;
+            } else if(c=='d'){
+                undoOp op;
+                op.type=undoOp::removeLine;
+                op.pos=pos;
+                op.before=before[i++];
+                recordOp(op);
+            } else {
+                undoOp op;
+                op.type=undoOp::insertLine;
+                op.pos=pos++;
+                op.after=after[j++];
+                recordOp(op);
             }
         }
+        return;
+    }
+
+    for(int i=start;i<beforeEnd;i++){
+        undoOp op;
+        op.type=undoOp::removeLine;
+        op.pos=start;
+        op.before=before[i];
+        recordOp(op);
+    }
+    for(int i=start;i<afterEnd;i++){
+        undoOp op;
+        op.type=undoOp::insertLine;
+        op.pos=i;
+        op.after=after[i];
+        recordOp(op);
     }
 }
 
-// Returns true of there is a need for a new undo
-bool todotxt::checkNeedForUndo(){
-    // check if the todo.txt is any different from the lastUndo file
-    vector<QString> todo;
-    vector<QString> lastUndo;
+void todotxt::saveToUndo()
+{
+    if(pendingOps.empty())
+        return;
 
-    if(undoBuffer.empty()){
-        return true;
+    // A new change makes whatever has been undone impossible to redo
+    while(undoPointer>0){
+        undoBytes-=undoJournal.back().bytes;
+        undoJournal.pop_back();
+        undoPointer--;
     }
 
-    QString todofile = getTodoFilePath();
-    QString undofile = undoBuffer.back()+(TODOFILE);
-    slurp(todofile,todo);
-    slurp(undofile,lastUndo);
-    if(todo.size()!=lastUndo.size()){
-        qDebug()<<"Sizes differ: "<<todofile<<" vs "<<undofile<<Qt::endl;
-        return true;
+    undoEntry entry;
+    entry.bytes=sizeof(undoEntry);
+    for(auto &op : pendingOps){
+        entry.bytes+=sizeof(undoOp)+(op.before.size()+op.after.size()+op.filename.size())*(qint64) sizeof(QChar);
+        for(auto &line : op.lines)
+            entry.bytes+=sizeof(QString)+line.size()*(qint64) sizeof(QChar);
+    }
+    entry.ops.swap(pendingOps);
+    undoBytes+=entry.bytes;
+    undoJournal.push_back(entry);
+    trimUndo();
+    //qDebug()<<"Undo journal is now: "<<undoJournal.size()<<" entries, "<<undoBytes<<" bytes"<<Qt::endl;
+}
+
+void todotxt::trimUndo()
+{
+    // Forget the oldest changes when the journal grows past the budget. The latest change is always kept.
+    qint64 budget = TodoSettings::current().undoBudget;
+    while(undoBytes>budget && undoJournal.size()>1){
+        undoBytes-=undoJournal.front().bytes;
+        undoJournal.pop_front();
     }
+}
 
-    // We got this far, we have to go trhough the files line by line
-    for(int i=0;i<(int) todo.size();i++){
-        if(todo[i] != lastUndo[i]){
-            qDebug()<<todo[i]<<" != "<<lastUndo[i]<<Qt::endl;
-            return true;
+void todotxt::applyUndo(undoEntry &entry,bool redo)
+{
+    bool doneTouched=false;
+    int n=(int) entry.ops.size();
+    for(int k=0;k<n;k++){
+        undoOp &op = entry.ops[redo?k:n-1-k];
+        switch(op.type){
+        case undoOp::insertLine:
+        case undoOp::removeLine:
+        case undoOp::replaceLine:
+            applyLineOp(op,redo,todo);
+            break;
+        case undoOp::appendFile:
+            if(redo){
+                op.offset=append(op.filename,op.lines);
+            } else if(op.offset>=0){
+                unappend(op);
+            }
+            if(op.filename==getDoneFilePath())
+                doneTouched=true;
+            break;
         }
     }
 
-    // Files are the same. No need to save a new undo.
-    return false;
+    // done no longer has what done.txt has. Reading it again is simpler than working out which lines went
+    if(doneTouched && doneLoaded)
+        loadDone();
+
+    dirty=true;
+    flush();
+    buildTasks();
 }
 
-void todotxt::saveToUndo()
-{
-    // This should be called every time we will read todo.txt
+// Before the file is cut back to where it was, its end has to be the lines we added. A sync client may have added
+// lines of its own since, and then only ours are taken out
+void todotxt::unappend(const undoOp &op){
+    QByteArray ours;
+    for(auto &line : op.lines){
+        ours += line.toUtf8();
+        ours += '\n';
+    }
 
-    // if we're moving around the undoBuffer, we should not be doing anything
-    if(undoPointer)
+    QFile file(op.filename);
+    if(!file.open(QIODevice::ReadWrite))
         return;
+    if(file.size()>=op.offset && file.seek(op.offset)){
+        QByteArray tail = file.readAll();
+        tail.replace("\r\n","\n"); // It was written in text mode
+        if(tail==ours || tail=="\n"+ours){ // append() starts with a newline if the file didn't end with one
+            file.resize(op.offset);
+            return;
+        }
+    }
 
-    // Start with checking if there is a change in the file compared to the last one in the undoBuffer
-    // (or if the undoBuffer is empty)
-    if(checkNeedForUndo() ){
-        // Creating a new undo is pretty simple.
-        // Just copy the todo.txt and the done.txt to the undo directory under a new name and save the filename in the undoBuffer
-        QString namePrefix = getNewUndoNameDirAndPrefix();
-        QString newtodo = namePrefix+TODOFILE;
-        QString newdone = namePrefix+DONEFILE;
-        QString newdeleted = namePrefix+DELETEDFILE;
+    // All of the file, doublets and all, as it is written back
+    file.seek(0);
+    QString content = QString::fromUtf8(file.readAll());
+    file.close();
+    content.remove('\r');
+    if(content.endsWith('\n'))
+        content.chop(1);
+    vector<QString> lines;
+    if(!content.isEmpty()){
+        QStringList list = content.split('\n');
+        lines.assign(list.begin(),list.end());
+    }
+    for(int k=(int) op.lines.size()-1;k>=0;k--){
+        // The last one, as that is where append() put it
+        for(int i=(int) lines.size()-1;i>=0;i--){
+            if(lines[i]==op.lines[k]){
+                lines.erase(lines.begin()+i);
+                break;
+            }
+        }
+    }
+    QString filename = op.filename;
+    write(filename,lines);
+}
+
+void todotxt::applyLineOp(const undoOp &op,bool redo,vector<QString> &doc){
+    // The line the op takes out of doc and the line it puts in, in the direction it is done
+    const QString *out=NULL;
+    const QString *in=NULL;
+    switch(op.type){
+    case undoOp::insertLine:
+        (redo?in:out)=&op.after;
+        break;
+    case undoOp::removeLine:
+        (redo?out:in)=&op.before;
+        break;
+    case undoOp::replaceLine:
+        out=redo?&op.before:&op.after;
+        in=redo?&op.after:&op.before;
+        break;
+    default:
+        return;
+    }
 
-        QFile::copy(getTodoFilePath(),newtodo);
-        QFile::copy(getDoneFilePath(),newdone);
-        QFile::copy(getDeletedFilePath(),newdeleted);
+    int pos=op.pos;
+    if(out!=NULL){
+        // Where the op says, unless the file has been changed by someone else since
+        if(pos<0 || pos>=(int) doc.size() || doc[pos]!=*out){
+            auto it=std::find(doc.begin(),doc.end(),*out);
+            pos=it==doc.end() ? -1 : (int) (it-doc.begin());
+        }
+        if(pos>=0){
+            if(in!=NULL)
+                doc[pos]=*in;
+            else
+                doc.erase(doc.begin()+pos);
+            return;
+        }
+        if(in==NULL)
+            return; // Already gone
+        pos=(int) doc.size(); // Changed by someone else too. Both versions are kept rather than losing one
+    }
+    pos=qBound(0,pos,(int) doc.size());
+    doc.insert(doc.begin()+pos,*in);
+}
 
-        undoBuffer.push_back(namePrefix);
-        qDebug()<<"Added to undoBuffer: "<<namePrefix<<Qt::endl;
-        qDebug()<<"Buffer is now: "<<undoBuffer.size()<<Qt::endl;
+void todotxt::takeFromDisk(vector<QString> &ondisk){
+    // Except for the first read, if the file differs from what we have, something has changed on disk
+    // outside of this program and that change should go into the undo journal.
+    if(loaded && ondisk!=todo){
+        recordDiff(todo,ondisk);
+        saveToUndo();
     }
+    todo.swap(ondisk);
+    todoKey=documentKey(todo);
+    dirty=false;
+    loaded=true;
+}
 
+bool todotxt::reloadIfChanged(){
+    if(!loaded || !changedOnDisk())
+        return false;
+    vector<QString> ondisk;
+    readTodo(ondisk);
+    takeFromDisk(ondisk);
+    return true;
 }
 
-QString todotxt::prettyPrint(QString& row){
-    QString ret;
-    QSettings settings;
+void todotxt::mergeFromDisk(){
+    // What the document was before the changes since the last commit
+    vector<QString> base(todo);
+    for(int k=(int) pendingOps.size()-1;k>=0;k--)
+        applyLineOp(pendingOps[k],false,base);
+
+    vector<QString> ondisk;
+    readTodo(ondisk);
+
+    // Their change becomes an undo step of its own, like when parse() finds one
+    vector<undoOp> ours;
+    ours.swap(pendingOps);
+    recordDiff(base,ondisk);
+    saveToUndo();
+
+    vector<QString> merged(ondisk);
+    for(auto &op : ours){
+        if(op.type==undoOp::appendFile)
+            recordOp(op);
+        else
+            applyLineOp(op,true,merged);
+    }
+    recordDiff(ondisk,merged);
+    todo.swap(merged);
+}
 
+QString todotxt::prettyPrint(QString& row){
     // Remove dates
     todoline tl;
     String2Todo(row,tl);
+    return prettyPrint(tl);
+}
+
+QString todotxt::prettyPrint(todoline &tl){
+    QString ret;
+    const TodoSettings &settings = TodoSettings::current();
 
     ret = tl.priority;
-    if(settings.value(SETTINGS_SHOW_DATES).toBool()){
+    if(settings.showDates){
         ret.append(tl.closedDate+tl.createdDate);
     }
 
@@ -549,32 +1047,123 @@ QString todotxt::prettyPrint(QString& row){
 }
 
 void todotxt::slurp(QString& filename,vector<QString>& content){
-    QSettings settings;
+    const TodoSettings &settings = TodoSettings::current();
     QFile file(filename);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+    if (!file.open(QIODevice::ReadOnly))
         return;
 
-    QTextStream in(&file);
-    in.setCodec("UTF-8");
-    while (!in.atEnd()) {
-        QString line = in.readLine();
-        if(settings.value(SETTINGS_REMOVE_DOUBLETS,DEFAULT_REMOVE_DOUBLETS).toBool()){
-            // This can be optimized by for example using a set<QString>
-            if(std::find(content.begin(),content.end(),line) != content.end()){
-                // We found this line. So we ignore it
+    // The file is mapped instead of read through a QTextStream, so the newlines can be found many bytes at a time
+    // and lines that are plain ASCII skip the UTF-8 decoding. \r is taken away like the text mode did
+    qint64 size = file.size();
+    const char *data = size>0 ? (const char *) file.map(0,size) : NULL;
+    QByteArray buffer;
+    if(data==NULL){
+        // Can't be mapped, like a file on some network shares. Or it has no size, which doesn't have to mean it is empty
+        buffer = file.readAll();
+        data = buffer.constData();
+        size = buffer.size();
+    }
+    if(size>=3 && (uchar) data[0]==0xEF && (uchar) data[1]==0xBB && (uchar) data[2]==0xBF){
+        // Byte order mark
+        data += 3;
+        size -= 3;
+    }
+    vector<scannedLine> lines;
+    scanLines(data,size,lines);
+
+    // Doublets are found with a hash set that is filled as we read, so this stays a single pass over the file.
+    // Lines that are already in content count as seen.
+    QSet<QString> seen;
+    int doublets = 0;
+    if(settings.removeDoublets){
+        seen.reserve((int) content.size());
+        for(auto &line : content)
+            seen.insert(line);
+    }
+
+    content.reserve(content.size()+lines.size());
+    for(auto &l : lines){
+        QString line;
+        if(l.ascii){
+            line = QString::fromLatin1(data+l.start,l.length);
+        } else {
+            line = QString::fromUtf8(data+l.start,l.length);
+            line.remove('\r');
+        }
+        if(settings.removeDoublets){
+            if(seen.contains(line)){
+                // We have already seen this line. So we ignore it
+                doublets++;
                 continue;
             }
+            seen.insert(line);
         }
         content.push_back(line);
      }
+
+    if(doublets>0){
+        qDebug()<<"Removed "<<doublets<<" doublets from "<<filename<<Qt::endl;
+    }
 }
 
-void todotxt::write(QString& filename,vector<QString>&  content){
-    // As we're about to write a change to the file, we have to consider what is now in the file as valid
-    // Thus we point the undo pointer to the last entry and check if we need to save what is now in the files before we overwrite it
-    undoPointer=0;
-    saveToUndo();
+// The same for done.txt, which is only read to be shown. The file stays mapped and the lines point into it
+void todotxt::slurp(QString& filename,lineArena& content){
+    const TodoSettings &settings = TodoSettings::current();
+    unique_ptr<QFile> file(new QFile(filename));
+    if (!file->open(QIODevice::ReadOnly))
+        return;
 
+    qint64 size = file->size();
+    const char *data = NULL;
+#ifdef Q_OS_UNIX
+    // On Windows a mapped file can't be replaced or deleted, which sync clients need to do
+    if(size>0)
+        data = (const char *) file->map(0,size,QFileDevice::MapPrivateOption);
+#endif
+    bool mapped = data!=NULL;
+    QByteArray bytes;
+    if(!mapped){
+        bytes = file->readAll();
+        data = bytes.constData();
+        size = bytes.size();
+    }
+    qint64 skip = 0;
+    if(size>=3 && (uchar) data[0]==0xEF && (uchar) data[1]==0xBB && (uchar) data[2]==0xBF){
+        // Byte order mark
+        skip = 3;
+    }
+    vector<scannedLine> lines;
+    scanLines(data+skip,size-skip,lines);
+    if(skip>0){
+        for(auto &l : lines)
+            l.start += skip;
+    }
+
+    // Doublets are compared on the bytes, without making QStrings of them
+    if(settings.removeDoublets){
+        QSet<QByteArray> seen;
+        seen.reserve((int) lines.size());
+        size_t kept = 0;
+        for(auto &l : lines){
+            QByteArray line = QByteArray::fromRawData(data+l.start,l.length);
+            if(seen.contains(line))
+                continue;
+            seen.insert(line);
+            lines[kept++] = l;
+        }
+        if(kept<lines.size()){
+            qDebug()<<"Removed "<<lines.size()-kept<<" doublets from "<<filename<<Qt::endl;
+            lines.resize(kept);
+        }
+    }
+
+    if(mapped)
+        content.assign(file,data,size,lines);
+    else
+        content.assign(bytes,lines);
+}
+
+void todotxt::write(QString& filename,vector<QString>&  content){
     //qDebug()<<"todotxt::write("<<filename<<")";
     QFile file(filename);
     if (!file.open(QIODevice::WriteOnly | QIODevice::Text))
@@ -584,19 +1173,178 @@ void todotxt::write(QString& filename,vector<QString>&  content){
         out.setCodec("UTF-8");
         for(unsigned int i = 0;	i<content.size(); i++)
             out << content.at(i) << "\n";
+        out.flush();
+        file.close();
+}
+
+qint64 todotxt::append(QString& filename,vector<QString>& content){
+    // Same as write, but only adds the lines at the end of the file so we don't have to read it first
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Text))
+         return -1;
+        qint64 offset = file.size();
+
+        // Make sure we start on a new line if someone left the file without one at the end
+        bool newline = false;
+        if(file.size()>0 && file.seek(file.size()-1)){
+            newline = (file.read(1) != "\n");
+        }
+        file.seek(file.size());
+
+        QTextStream out(&file);
+        out.setCodec("UTF-8");
+        if(newline)
+            out << "\n";
+        for(unsigned int i = 0;	i<content.size(); i++)
+            out << content.at(i) << "\n";
+        out.flush();
+        file.close();
+        return offset;
+}
+
+void todotxt::flush(){
+    if(!dirty)
+        return;
+    QString todofile = getTodoFilePath();
+    write(todofile,todo);
+    rememberFileState();
+    todoKey=documentKey(todo);
+    dirty=false;
+}
+
+void todotxt::commit(){
+    if(transactionDepth>0)
+        return; // Everything is written when the transaction is committed
+
+    if(dirty || !pendingDone.empty() || !pendingDeleted.empty()){
+        if(!pendingDeleted.empty()){
+            QString deletedfile = getDeletedFilePath();
+            recordAppend(deletedfile,pendingDeleted);
+            pendingDeleted.clear();
+        }
+        if(!pendingDone.empty()){
+            QString donefile = getDoneFilePath();
+            bool sameDone = doneLoaded && !doneChangedOnDisk();
+            recordAppend(donefile,pendingDone);
+            pendingDone.clear();
+            if(sameDone)
+                rememberDoneState(); // archive() has put the lines in done as well, so it still has what the file has
+        }
+        if(dirty && loaded && changedOnDisk())
+            mergeFromDisk(); // Someone else wrote the file since we read it, so writing ours would lose their change
+        flush();
+
+        // Everything that was done since the last commit becomes one undo step
+        saveToUndo();
+    }
+    buildTasks();
+}
+
+void todotxt::recordAppend(QString& filename,vector<QString>& content){
+    undoOp op;
+    op.type=undoOp::appendFile;
+    op.pos=0;
+    op.filename=filename;
+    op.offset=append(filename,content);
+    op.lines=content;
+    if(op.offset>=0)
+        recordOp(op);
+}
+
+void todotxt::beginTransaction(){
+    transactionDepth++;
+}
+
+void todotxt::commitTransaction(){
+    if(transactionDepth==0)
+        return;
+    transactionDepth--;
+    commit();
+}
+
+bool todotxt::inTransaction(){
+    return transactionDepth>0;
+}
+
+void todotxt::rememberFileState(){
+    QFileInfo fi(getTodoFilePath());
+    todoSize = fi.exists() ? fi.size() : -1;
+    todoModified = fi.lastModified();
+    todoReplaced = fi.metadataChangeTime();
+}
+
+bool todotxt::changedOnDisk(){
+    QFileInfo fi(getTodoFilePath());
+    qint64 size = fi.exists() ? fi.size() : -1;
+    if(size==todoSize && fi.lastModified()==todoModified && fi.metadataChangeTime()==todoReplaced)
+        return false;
+
+    // Something has written the file. Sync clients and editors often write back the same lines,
+    // and then there is nothing to reload
+    QString todofile=getTodoFilePath();
+    vector<QString> ondisk;
+    slurp(todofile,ondisk);
+    if(documentKey(ondisk)!=todoKey){
+        // Kept for readTodo(), as whoever asked is about to read the file
+        readLines.swap(ondisk);
+        readSize = size;
+        readModified = fi.lastModified();
+        readReplaced = fi.metadataChangeTime();
+        haveReadLines = true;
+        return true;
+    }
+    rememberFileState();
+    return false;
+}
+
+void todotxt::readTodo(vector<QString> &ondisk){
+    QString todofile=getTodoFilePath();
+    if(haveReadLines){
+        // What changedOnDisk() read, unless the file has been written again since
+        haveReadLines = false;
+        QFileInfo fi(todofile);
+        qint64 size = fi.exists() ? fi.size() : -1;
+        if(size==readSize && fi.lastModified()==readModified && fi.metadataChangeTime()==readReplaced){
+            ondisk.swap(readLines);
+            vector<QString>().swap(readLines);
+            rememberFileState();
+            return;
+        }
+        vector<QString>().swap(readLines);
+    }
+    slurp(todofile,ondisk);
+    rememberFileState();
+}
+
+void todotxt::loadDone(){
+    QString donefile = getDoneFilePath();
+    done.clear();
+    slurp(donefile,done);
+    rememberDoneState();
+    doneLoaded=true;
+    doneVersion++;
+}
 
+void todotxt::rememberDoneState(){
+    QFileInfo fi(getDoneFilePath());
+    doneSize = fi.exists() ? fi.size() : -1;
+    doneModified = fi.lastModified();
+    doneReplaced = fi.metadataChangeTime();
+}
 
+bool todotxt::doneChangedOnDisk(){
+    if(!doneLoaded)
+        return false;
+    QFileInfo fi(getDoneFilePath());
+    qint64 size = fi.exists() ? fi.size() : -1;
+    return size!=doneSize || fi.lastModified()!=doneModified || fi.metadataChangeTime()!=doneReplaced;
 }
 
 void todotxt::remove(QString line){
     // Remove the line, but perhaps saving it for later as well..
-    QSettings settings;
-    if(settings.value(SETTINGS_DELETED_FILE).toBool()){
-        QString deletedfile = getDeletedFilePath();
-        vector<QString> deleteddata;
-        slurp(deletedfile,deleteddata);
-        deleteddata.push_back(line);
-        write(deletedfile,deleteddata);
+    const TodoSettings &settings = TodoSettings::current();
+    if(settings.deletedFile){
+        pendingDeleted.push_back(line); // Appended to deleted.txt on commit
     }
     QString tmp;
     update(line,false,tmp);
@@ -604,43 +1352,58 @@ void todotxt::remove(QString line){
 
 
 void todotxt::archive(){
-    // Slurp the files
-    QSettings settings;
-    QString todofile = getTodoFilePath();
-    QString donefile = getDoneFilePath();
+    // Move the done lines over to done.txt. done.txt is only appended to, so we never have to read it here
     vector<QString> tododata;
     vector<QString> donedata;
-    slurp(todofile,tododata);
-    slurp(donefile,donedata);
-    for(vector<QString>::iterator iter=tododata.begin();iter!=tododata.end();){
+    for(vector<QString>::iterator iter=todo.begin();iter!=todo.end();iter++){
         if((*iter).length()>0 && (*iter).at(0)=='x'){
             donedata.push_back((*iter));
-            iter=tododata.erase(iter);
+            undoOp op;
+            op.type=undoOp::removeLine;
+            op.pos=(int) tododata.size(); // Where the line is once the ones before it have been moved
+            op.before=(*iter);
+            recordOp(op);
         } else {
-            // No change
-            iter++;
+            tododata.push_back((*iter));
         }
+    }
+    if(donedata.empty())
+        return;
 
+    const TodoSettings &settings = TodoSettings::current();
+    if(settings.showAll){
+        for(auto &line : donedata)
+            done.append(line);
     }
-    write(todofile,tododata);
-    write(donefile,donedata);
-    parse();
+    pendingDone.insert(pendingDone.end(),donedata.begin(),donedata.end());
+    todo.swap(tododata);
+    dirty=true;
+    commit();
 }
 
 void todotxt::refresh(){
     parse();
 }
 
+void todotxt::rebuild(){
+    // Nothing that is parsed depends on the date, so the records are kept. What does, like whether a
+    // task is inactive, is worked out again for all of them by buildTasks()
+    buildTasks();
+}
+
 void todotxt::update(QString &row, bool checked, QString &newrow){
-    // First slurp the file.
-    QSettings settings;
-    QString todofile = getTodoFilePath();
-    vector<QString> data;
-    slurp(todofile,data);
-    QString additional_item = ""; // This is for recurrence. If there is a new item created, put it here since we have to add it after the file is written
+    modify(row,checked,newrow);
+    commit();
+}
+
+void todotxt::modify(QString &row, bool checked, QString &newrow){
+    // Works on the in-memory document. Nothing is written until commit()
+    const TodoSettings &settings = TodoSettings::current();
+    vector<QString> &data = todo;
+    QString additional_item = ""; // This is for recurrence. If there is a new item created, put it here since we have to add it after the line is changed
 
     // Preprocessing of the line
-    if(settings.value(SETTINGS_THRESHOLD).toBool()){
+    if(settings.threshold){
         QRegularExpression threshold_shorthand("(t:\\+?\\d+[dwmypb])");
         QRegularExpressionMatch m = threshold_shorthand.match(newrow);
         if(m.hasMatch()){
@@ -648,7 +1411,7 @@ void todotxt::update(QString &row, bool checked, QString &newrow){
         }
     }
 
-    if(settings.value(SETTINGS_DUE).toBool()){
+    if(settings.due){
         QRegularExpression due_shorthand("(due:\\+?\\d+[dwmypb])");
         QRegularExpressionMatch m = due_shorthand.match(newrow);
         if(m.hasMatch()){
@@ -660,21 +1423,34 @@ void todotxt::update(QString &row, bool checked, QString &newrow){
         todoline tl;
         String2Todo(newrow,tl);
         // Add a date to the line if where doing dates
-        if(settings.value(SETTINGS_DATES).toBool()){
+        if(settings.dates){
             QString today = getToday()+" ";
             tl.createdDate = today;
         }
 
         // Just add the line
         data.push_back(Todo2String(tl));
+        dirty=true;
+
+        undoOp op;
+        op.type=undoOp::insertLine;
+        op.pos=(int) data.size()-1;
+        op.after=data.back();
+        recordOp(op);
 
     } else {
         for(vector<QString>::iterator iter=data.begin();iter!=data.end();iter++){
             QString *r = &(*iter);
             if(!r->compare(row)){
                 // Here it is.. Lets modify if we shouldn't remove it alltogether
+                dirty=true;
+                undoOp op;
+                op.pos=(int) (iter-data.begin());
+                op.before=*r;
                 if(newrow.isEmpty()){
                     // Remove it
+                    op.type=undoOp::removeLine;
+                    recordOp(op);
                     iter=data.erase(iter);
                     break;
                 }
@@ -685,7 +1461,7 @@ void todotxt::update(QString &row, bool checked, QString &newrow){
                     tl.checked=true;
 
                     QString date;
-                    if(settings.value(SETTINGS_DATES).toBool()){
+                    if(settings.dates){
                             date.append(getToday()+" "); // Add a date if needed
                     }
                     tl.closedDate=date;
@@ -750,55 +1526,201 @@ void todotxt::update(QString &row, bool checked, QString &newrow){
                     tl.closedDate = newtl.closedDate;
                     *r = Todo2String(tl);
                 }
+                op.type=undoOp::replaceLine;
+                op.after=*r;
+                recordOp(op);
                 break;
             }
         }
     }
 
-    write(todofile,data);
     if(!additional_item.isEmpty()){
         QString empty="";
-        this->update(empty,false,additional_item);
+        this->modify(empty,false,additional_item);
     }
-    parse();
 }
 
-// A todo.txt line looks like this
-static QRegularExpression todo_line("(x\\s+)?(\\([A-Z]\\)\\s+)?(\\d\\d\\d\\d-\\d\\d-\\d\\d\\s+)?(\\d\\d\\d\\d-\\d\\d-\\d\\d\\s+)?(.*)");
+// The patterns the lines used to be taken apart with had \s and \d, which without unicode properties are ASCII only
+static inline bool isBlank(QChar c){
+    ushort u = c.unicode();
+    return u==' ' || (u>=9 && u<=13);
+}
 
-void todotxt::String2Todo(QString &line,todoline &t){
-    QRegularExpressionMatch match = todo_line.match(line);
-    if(match.hasMatch() && match.lastCapturedIndex()==5){
+static inline bool isDigit(QChar c){
+    ushort u = c.unicode();
+    return u>='0' && u<='9';
+}
 
-        if(match.captured(1).isEmpty()){
-            t.checked=false;
-        } else {
-            t.checked=true;
+// dddd-dd-dd at p
+static bool isDate(QStringView s,int p){
+    if(p<0 || p+10>s.size())
+        return false;
+    for(int k=0;k<10;k++){
+        if(k==4 || k==7){
+            if(s[p+k]!='-')
+                return false;
+        } else if(!isDigit(s[p+k])){
+            return false;
         }
+    }
+    return true;
+}
 
-        t.priority=match.captured(2);
-        if(t.checked){
-            t.closedDate=match.captured(3);
-            t.createdDate=match.captured(4);
-        } else {
-            t.createdDate=match.captured(3); // No closed date on a line that isn't closed.
+// The same as julianFrom() for something isDate() said yes to, without making a QString
+static int julianAt(QStringView s,int p){
+    auto number=[&](int from,int digits){
+        int n=0;
+        for(int k=0;k<digits;k++)
+            n = n*10 + (s[from+k].unicode()-'0');
+        return n;
+    };
+    QDate d(number(p,4),number(p+5,2),number(p+8,2));
+    if(!d.isValid())
+        return 0;
+    return (int) d.toJulianDay();
+}
+
+// The characters of the URL pattern: what comes before :// and what can come after it
+static inline bool isUrlScheme(QChar c){
+    ushort u = c.unicode();
+    return (u>='a' && u<='z') || (u>='A' && u<='Z') || (u>='0' && u<='9') || u=='_';
+}
+
+static inline bool isUrlChar(QChar c){
+    if(isUrlScheme(c))
+        return true;
+    ushort u = c.unicode();
+    return u>0 && u<128 && strchr("-@:%+.~#?&/=(){}\\",(char) u)!=NULL;
+}
+
+// Takes a line apart in one pass. The header is x, priority and dates as the todo_line pattern in tests/tokenizer has them,
+// including that an open task with two dates loses the second one. With words set it also finds what the
+// project, context, t:, due: and URL patterns there find, in the same order
+void todotxt::tokenize(QStringView line,linetokens &k,bool words){
+    int n = line.size();
+    int i = 0;
+    k.checked = false;
+    k.priority = QStringView();
+    k.closedDate = QStringView();
+    k.createdDate = QStringView();
+
+    auto skipBlanks=[&](){
+        while(i<n && isBlank(line[i]))
+            i++;
+    };
+
+    if(n>=2 && line[0]=='x' && isBlank(line[1])){
+        k.checked = true;
+        i = 1;
+        skipBlanks();
+    }
+    if(i+3<n && line[i]=='(' && line[i+1]>='A' && line[i+1]<='Z' && line[i+2]==')' && isBlank(line[i+3])){
+        int start = i;
+        i += 3;
+        skipBlanks();
+        k.priority = line.mid(start,i-start);
+    }
+    QStringView dates[2];
+    for(int d=0;d<2;d++){
+        if(i+10<n && isDate(line,i) && isBlank(line[i+10])){
+            int start = i;
+            i += 10;
+            skipBlanks();
+            dates[d] = line.mid(start,i-start);
         }
-        t.text = match.captured(5);
+    }
+    if(k.checked){
+        k.closedDate = dates[0];
+        k.createdDate = dates[1];
+    } else {
+        k.createdDate = dates[0]; // No closed date on a line that isn't closed.
+    }
+    k.text = line.mid(i);
+
+    if(!words)
+        return;
 
+    k.projects.clear();
+    k.contexts.clear();
+    k.thresholdProjects.clear();
+    k.thresholdContexts.clear();
+    k.thresholdDates.clear();
+    k.dueDate = INT_MAX;
+    k.urlStart = -1;
+    k.urlLength = 0;
+
+    i = 0;
+    while(i<n){
+        skipBlanks();
+        int start = i;
+        while(i<n && !isBlank(line[i]))
+            i++;
+        int end = i;
+        if(end-start>1){
+            // The patterns wanted whitespace before a tag, which left out a tag that starts the line
+            if(line[start]=='+')
+                k.projects.push_back(line.mid(start,end-start));
+            else if(line[start]=='@')
+                k.contexts.push_back(line.mid(start,end-start));
+        }
 
+        // t:, due: and :// can be anywhere in a word, as the patterns for them were not anchored
+        bool thresholdProject = false;
+        bool thresholdContext = false;
+        for(int p=start;p+1<end;){
+            QChar c = line[p];
+            if(c=='t' && line[p+1]==':'){
+                if(isDate(line,p+2)){
+                    k.thresholdDates.push_back(julianAt(line,p+2));
+                    p += 12;
+                    continue;
+                }
+                // The rest of the word is the tag, so there is only ever one of each per word
+                if(p+3<end && line[p+2]=='+' && !thresholdProject){
+                    k.thresholdProjects.push_back(line.mid(p+2,end-p-2));
+                    thresholdProject = true;
+                } else if(p+3<end && line[p+2]=='@' && !thresholdContext){
+                    k.thresholdContexts.push_back(line.mid(p+2,end-p-2));
+                    thresholdContext = true;
+                }
+            } else if(c=='d' && k.dueDate==INT_MAX && p+3<end && line[p+1]=='u' && line[p+2]=='e' && line[p+3]==':' && isDate(line,p+4)){
+                k.dueDate = julianAt(line,p+4);
+            } else if(c==':' && k.urlStart<0 && p>start && p+2<end && line[p+1]=='/' && line[p+2]=='/' && isUrlScheme(line[p-1])){
+                int s = p-1;
+                while(s>start && isUrlScheme(line[s-1]))
+                    s--;
+                int e = p+3;
+                while(e<end && isUrlChar(line[e]))
+                    e++;
+                k.urlStart = s;
+                k.urlLength = e-s;
+            }
+            p++;
+        }
+    }
+}
+
+void todotxt::todoFromTokens(const linetokens &k,todoline &t){
+    t.checked = k.checked;
+    t.priority = k.priority.toString();
+    if(t.checked){
+        t.closedDate = k.closedDate.toString();
+        t.createdDate = k.createdDate.toString();
     } else {
-        t.checked=false;
-        t.priority="";
-        t.closedDate="";
-        t.createdDate="";
-        t.text="";
+        t.createdDate = k.createdDate.toString();
     }
+    t.text = k.text.toString();
+}
 
+void todotxt::String2Todo(QString &line,todoline &t){
+    linetokens k;
+    tokenize(line,k,false);
+    todoFromTokens(k,t);
 }
 
 QString todotxt::Todo2String(todoline &t){
     QString ret;
-    QSettings settings;
+    const TodoSettings &settings = TodoSettings::current();
 
     // Yep, an ugly side effect, but it make sure we're having the right format all the time
     if(t.checked && t.createdDate.isEmpty()){
@@ -815,7 +1737,7 @@ QString todotxt::Todo2String(todoline &t){
     ret.append(t.createdDate);
     // Here we have to decide how to handle priority tag if we have one
     if(t.checked && !t.priority.isEmpty()){
-        prio_on_close how = (prio_on_close) settings.value(SETTINGS_PRIO_ON_CLOSE,DEFAULT_PRIO_ON_CLOSE).toInt();
+        prio_on_close how = (prio_on_close) settings.prioOnClose;
         switch(how){
             case prio_on_close::removeit:
                 break; // We do nothing. Just forget it exists
@@ -841,8 +1763,8 @@ QString todotxt::Todo2String(todoline &t){
 
 int todotxt::dueIn(QString &text){
     int ret=INT_MAX;
-    QSettings settings;
-    if(settings.value(SETTINGS_DUE).toBool()){
+    const TodoSettings &settings = TodoSettings::current();
+    if(settings.due){
         QRegularExpressionMatch m=regex_due_date.match(text);
         if(m.hasMatch()){
             QString ds = m.captured(1);
@@ -863,8 +1785,23 @@ QDate todotxt::dateFrom(QString &s){
     return *new QDate();
 }
 
+int todotxt::julianFrom(const QString &date){
+    QDate d = QDate::fromString(date.trimmed(),"yyyy-MM-dd");
+    if(!d.isValid())
+        return 0;
+    return (int) d.toJulianDay();
+}
+
+int todotxt::dueIn(const todotask &t){
+    const TodoSettings &settings = TodoSettings::current();
+    if(!settings.due || t.dueDate==INT_MAX)
+        return INT_MAX;
+    if(t.dueDate==0)
+        return 0; // Not a valid date. QDate::daysTo() says 0 for those as well
+    return t.dueDate-(int) QDate::currentDate().toJulianDay();
+}
+
 //QRegularExpression regex_url("[a-zA-Z0-9_]+://[-a-zA-Z0-9@:%._\\+~#=]{2,256}\\.[a-z]{2,6}\\b([-a-zA-Z0-9@:%_\\+.~#?&//=\\(\\)]*)");
-static QRegularExpression regex_url("[a-zA-Z0-9_]+:\\/\\/([-a-zA-Z0-9@:%_\\+.~#?&\\/=\\(\\)\\{\\}\\\\]*)");
 
 QString todotxt::getURL(QString &line){
     QRegularExpressionMatch m=regex_url.match(line);
@@ -876,3 +1813,159 @@ QString todotxt::getURL(QString &line){
         return "";
     }
 }
+
+QString todotxt::getURL(const todotask &t){
+    if(t.urlStart<0)
+        return "";
+    return rawLine(t).mid(t.urlStart,t.urlLength);
+}
+
+todotxt::shownLine *todotxt::showLine(const todotask &t){
+    shownLine *s = shown.object(t.line);
+    if(s==NULL){
+        s = new shownLine;
+        s->raw = done.at(t.line);
+        s->pretty = prettyPrint(s->raw);
+        findSpans(s->pretty,s->spans);
+        shown.insert(t.line,s);
+    }
+    return s;
+}
+
+QString todotxt::rawLine(const todotask &t){
+    if(t.line<0)
+        return t.raw;
+    return showLine(t)->raw;
+}
+
+QString todotxt::prettyLine(const todotask &t){
+    if(t.line<0)
+        return t.pretty;
+    return showLine(t)->pretty;
+}
+
+vector<todotxt::textSpan> todotxt::lineSpans(const todotask &t){
+    if(t.line<0)
+        return t.spans;
+    return showLine(t)->spans;
+}
+
+// 64 bit FNV-1a, so that two different lines in the same list practically never get the same key
+quint64 todotxt::lineKey(const QString &line){
+    quint64 h = 14695981039346656037ULL;
+    const ushort *p = line.utf16();
+    for(int i=0;i<line.length();i++){
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+quint64 todotxt::documentKey(const vector<QString> &lines){
+    quint64 h = 14695981039346656037ULL;
+    for(const QString &line:lines){
+        h ^= lineKey(line);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+// Finds what the table highlights in the pretty printed text. One pass over the words, so the view never has to look for them
+void todotxt::findSpans(const QString &pretty,vector<textSpan> &spans){
+    spans.clear();
+    int n = pretty.length();
+    int i = 0;
+    if(n>=3 && pretty[0]=='(' && pretty[1]>='A' && pretty[1]<='Z' && pretty[2]==')' && (n==3 || pretty[3]==' ')){
+        spans.push_back({textSpan::priority,0,3});
+        i = 3;
+    }
+    while(i<n){
+        while(i<n && pretty[i].isSpace())
+            i++;
+        int start = i;
+        while(i<n && !pretty[i].isSpace())
+            i++;
+        int length = i-start;
+        if(length<2)
+            continue;
+        QChar c = pretty[start];
+        if(c=='+'){
+            spans.push_back({textSpan::project,start,length});
+        } else if(c=='@'){
+            spans.push_back({textSpan::context,start,length});
+        } else if(length>4 && pretty.midRef(start,4)==QLatin1String("due:")){
+            spans.push_back({textSpan::due,start,length});
+        }
+    }
+}
+
+void todotxt::parseTask(QString &line,todotask &t){
+    tokenize(line,scan,true);
+    todoline tl;
+    todoFromTokens(scan,tl);
+
+    t.line = -1;
+    t.raw = line;
+    t.pretty = prettyPrint(tl);
+    t.key = lineKey(line);
+    if(line.isEmpty())
+        t.section = 0;
+    else if(line.length()>2 && line.at(0)=='(' && line.at(2)==')')
+        t.section = '(';
+    else if(line.at(0)=='x')
+        t.section = 'x';
+    else
+        t.section = ' ';
+    t.marked = false;
+    for(auto &marker : TodoSettings::current().inactives){
+        if(line.contains(marker)){
+            t.marked = true;
+            break;
+        }
+    }
+    t.checked = (getState(line) == Qt::Checked);
+    t.priority = tl.priority;
+    t.createdDate = julianFrom(tl.createdDate);
+    t.closedDate = julianFrom(tl.closedDate);
+    t.dueDate = scan.dueDate;
+
+    t.thresholdDate = 0;
+    for(int td : scan.thresholdDates){
+        if(td>t.thresholdDate)
+            t.thresholdDate = td;
+    }
+
+    t.projects.clear();
+    for(auto &project : scan.projects)
+        t.projects << project.toString();
+    t.contexts.clear();
+    for(auto &context : scan.contexts)
+        t.contexts << context.toString();
+    t.tagIds.clear();
+    for(auto &project : t.projects)
+        t.tagIds.push_back(internTag(project));
+    for(auto &context : t.contexts)
+        t.tagIds.push_back(internTag(context));
+    std::sort(t.tagIds.begin(),t.tagIds.end());
+    t.tagIds.erase(std::unique(t.tagIds.begin(),t.tagIds.end()),t.tagIds.end());
+
+    t.thresholdTags.clear();
+    for(auto &project : scan.thresholdProjects)
+        t.thresholdTags.push_back(internTag(project.toString()));
+    for(auto &context : scan.thresholdContexts)
+        t.thresholdTags.push_back(internTag(context.toString()));
+
+    t.urlStart = scan.urlStart;
+    t.urlLength = scan.urlLength;
+
+    t.inactive = false; // Set by buildTasks() once the active tags are known
+    findSpans(t.pretty,t.spans);
+
+    QString firstword = line.section(' ',0,0);
+    t.sortWord = prettyPrint(firstword).toLower();
+    static const QString doneWord = QStringLiteral("x");
+    if(t.sortWord==doneWord)
+        t.sortWord = doneWord; // Nearly every line in done.txt has this, and this way they don't have a copy each
+    t.sortDue = t.dueDate>0 ? t.dueDate : INT_MAX;
+    findWords(t,t.pretty.toLower());
+}
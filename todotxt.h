@@ -12,23 +12,142 @@
 
 #include <vector>
 #include <set>
+#include <deque>
+#include <map>
+#include <memory>
 #include <QString>
 #include <QDate>
-#include <QTemporaryDir>
+#include <QDateTime>
+#include <QStringList>
+#include <QStringView>
+#include <QHash>
+#include <QCache>
+#include "linearena.h"
+#include "postinglists.h"
 
 using namespace std;
 
 class todotxt
 {
+public:
+    // A part of the pretty text that is shown in its own style
+    struct textSpan{
+        enum kind_t {priority, project, context, due} kind;
+        int start;              // Position in pretty
+        int length;
+    };
+
+    // A todo.txt line parsed into its parts. This is done once per line in parse() so that
+    // the model only has to read fields instead of running regexes on every repaint.
+    struct todotask{
+        int id;                 // Index of the record in tasks, and what the posting lists refer to. Kept while the line is there
+        int line;               // The line in done if it is from done.txt, -1 if it is from todo.txt
+        QString raw;            // The line exactly as it is in the file. Empty for lines from done.txt, see rawLine()
+        QString pretty;         // The output of prettyPrint(). Empty for lines from done.txt, see prettyLine()
+        quint64 key;            // A hash of the line, what the table tells rows apart by
+        bool marked;            // The line has one of the inactive markers in it
+        char section;           // How the line starts, for getRows(): 0 if it is empty, 'x', '(' for a priority, else ' '
+        bool checked;
+        QString priority;       // "(A) " or empty
+        int createdDate;        // Dates are in julian days, 0 if not set
+        int closedDate;
+        int dueDate;            // INT_MAX if there is no due:
+        int thresholdDate;      // The latest t: date, 0 if there is none
+        QStringList projects;   // Empty for lines from done.txt, as tagIds has them
+        QStringList contexts;
+        vector<int> tagIds;     // projects and contexts as interned ids, sorted and without repeats
+        vector<int> thresholdTags; // Ids of the tags in t:+project and t:@context
+        int urlStart;           // -1 if there is no URL on the line
+        int urlLength;
+        bool inactive;          // The result of isInactive(), set by buildTasks()
+        vector<textSpan> spans; // The priority, tags and due: in pretty, in order. Empty for lines from done.txt, see lineSpans()
+
+        // Sort key for the alphabetical sort, so that comparing two tasks doesn't have to parse them again
+        QString sortWord;       // The pretty printed first word, lower-cased. Lines that start with x share one string
+        int sortDue;            // dueDate, or INT_MAX if it is missing or invalid
+        vector<int> words;      // Ids of the words of pretty, lower-cased, in order. What the text is sorted and searched by
+    };
+
+    // Every distinct project and context gets a small integer id the first time it is seen. This is a copy
+    // of that dictionary, names as written, together with the ids of the tasks that have each tag
+    struct tagIndex : postingLists{};
+
+    // The words of the lower-cased pretty text of every task, with the ids of the tasks that have them.
+    // A search word is somewhere in the text of a task exactly when it is part of one of its words, so
+    // the search only has to look through the distinct words instead of every task.
+    // Words get ids in the order they are seen, so that anything built on the words only has to look at
+    // the new ones after a change. Words that are no longer used have no tasks, until there are so many
+    // of those that the ids are given out again without them, see compactWords()
+    struct wordIndex : postingLists{
+        int epoch = 0; // Goes up every time the ids are given out again
+    };
+
 protected:
     QString filedirectory;
-    vector<QString> todo;
-    vector<QString> done;
-    set<QString> active_projects;
-    set<QString> active_contexts;
-    static bool lessThan(QString &,QString &);
+    vector<QString> todo; // The lines of todo.txt. This in-memory copy is what we edit and write back
+    lineArena done; // The lines of done.txt. Only loaded when showing all. Kept as UTF-8, as there can be many
+    vector<todotask> tasks; // By task id, one for every line in todo and done, built by buildTasks(). Some may be unused
+    vector<int> todoIds;    // The ids of the lines of todo, in order
+    vector<int> doneIds;    // The same for done
+    vector<int> freeIds;    // Records that no line has, to be used for the next new lines
+    QHash<QString,int> tagIds;  // The tag dictionary. Ids are never reused, so they stay valid as long as we live
+    int tagCount = 0;
+    vector<QString> newTags;    // Tags that are not in the tag index yet, in the order of their ids
+    vector<char> activeTags;    // Indexed by tag id, set for tags of open tasks when thresholdLabels is on
+    shared_ptr<const tagIndex> tags; // Made again when the tasks change. Never changed once made, so a search thread can keep a copy
+    QHash<QString,int> wordIds; // The word dictionary, used the same way as the tag dictionary
+    int wordCount = 0;
+    vector<QString> newWords;
+    shared_ptr<const wordIndex> words; // The same
+    bool dirty = false; // todo has changes that are not written to disk yet
+    qint64 todoSize = -1; // Size and modification times of todo.txt when we last read or wrote it
+    QDateTime todoModified;
+    QDateTime todoReplaced; // The metadata change time, which is new when the file is replaced by a rename as well
+    quint64 todoKey = 0;  // documentKey() of the lines we last read or wrote
+    vector<QString> readLines; // What changedOnDisk() found in todo.txt, so it isn't read twice
+    bool haveReadLines = false;
+    qint64 readSize = -1;  // The state of todo.txt when readLines was read
+    QDateTime readModified;
+    QDateTime readReplaced;
+    void readTodo(vector<QString> &ondisk); // Reads todo.txt, or takes what changedOnDisk() read if it is still the same
+    vector<QString> pendingDone; // Lines to append to done.txt on the next commit
+    vector<QString> pendingDeleted; // Lines to append to deleted.txt on the next commit
+    int transactionDepth = 0;
+    struct shownLine{
+        QString raw;
+        QString pretty;
+        vector<textSpan> spans;
+    };
+    QCache<int,shownLine> shown; // The lines from done that have been asked for lately, by line in done
+    shownLine *showLine(const todotask &t);
+    bool taskLessThan(const todotask &,const todotask &) const;
     bool threshold_hide(QString &);
-    QTemporaryDir *undoDir;
+    bool threshold_hide(const todotask &t);
+    int internTag(const QString &tag);
+    int findTag(const QString &tag); // -1 if the tag has never been seen
+    int internWord(const QString &word);
+    void findWords(todotask &t,const QString &text);
+    void parseTask(QString &line,todotask &t);
+    static void findSpans(const QString &pretty,vector<textSpan> &spans);
+    void buildTasks(); // Rebuilds the task records from the in-memory document, parsing only the lines that are new
+    int newTask(); // The id of a record for a new line
+    void updateIndexes(const vector<int> &added,const vector<int> &removed); // The tags and words of the added and removed tasks have changed
+    shared_ptr<wordIndex> compactWords(const wordIndex &index); // The index without the words no task has, with the records changed to match
+    int parsedGeneration = -1; // The settings generation the records were parsed with
+    int doneVersion = 0;    // Bumped when done is read again, as the records of its lines are no longer valid then
+    int builtDone = -1;     // The doneVersion the records were built from
+    bool doneLoaded = false; // done has the lines of done.txt
+    qint64 doneSize = -1;   // Size and modification times of done.txt when we last read it or added to it
+    QDateTime doneModified;
+    QDateTime doneReplaced;
+    void loadDone(); // Reads done.txt into done
+    void rememberDoneState();
+    void modify(QString &row,bool checked,QString &newrow); // Applies an update to the in-memory document only
+    void commit(); // Writes the document if it is dirty and rebuilds the task records. Does nothing inside a transaction
+    void flush();
+    void rememberFileState();
+    qint64 append(QString& filename,vector<QString>& content); // Returns the size the file had before, -1 on failure
+    void recordAppend(QString& filename,vector<QString>& content); // Appends and records it for undo
 
 public:
     todotxt();
@@ -36,19 +155,41 @@ public:
     void setdirectory(QString &dir);
     void parse(); // Parses the files in the directory
     void getActive(QString& filter,vector<QString> &output);
-    void getAll(QString& filter,vector<QString> &output);
+    void getAll(QString& filter,vector<todotask> &output);
+    void getRows(vector<int> &output); // The ids of the tasks to show, in the order to show them
+    const todotask &getTask(int id);
+    QString rawLine(const todotask &t);     // The same as t.raw, also for tasks from done.txt
+    QString prettyLine(const todotask &t);  // The same as t.pretty, also for tasks from done.txt
+    vector<textSpan> lineSpans(const todotask &t); // The same as t.spans, also for tasks from done.txt
+    static quint64 lineKey(const QString &line);
+    static quint64 documentKey(const vector<QString> &lines); // The lines and their order
+    shared_ptr<const tagIndex> getTagIndex();
+    shared_ptr<const wordIndex> getWordIndex();
+    int taskCount(); // Ids are below this
+    static void countTags(const tagIndex &index,const vector<int> &ids,int taskCount,map<QString,int> &counts); // Number of the tasks in ids that have each tag, by the name the tag panel shows
     Qt::CheckState getState(QString& row);
     static QString prettyPrint(QString& row);
     void update(QString& row,bool checked,QString& newrow);
     void write(QString& filename,vector<QString>&  content);
     void slurp(QString& filename,vector<QString>&  content);
+    void slurp(QString& filename,lineArena& content);
     QString getURL(QString &line);
+    QString getURL(const todotask &t);
     void remove(QString line);
     void archive();
     void refresh();
+    void rebuild(); // Builds the tasks again from the lines in memory, for when the date has changed
+    void beginTransaction(); // Changes made until commitTransaction() are written with one write and one undo entry
+    void commitTransaction();
+    bool inTransaction();
+    bool changedOnDisk(); // True if todo.txt does not have the lines we last read or wrote
+    bool doneChangedOnDisk(); // True if done.txt is loaded and is not what we last read or added to it
     bool isInactive(QString& text);
+    bool isInactive(const todotask &t);
     int  dueIn(QString& text);
+    int  dueIn(const todotask &t);
     static QDate dateFrom(QString &);
+    static int julianFrom(const QString &date);
     QString getToday();
     QString getTodoFilePath();
     QString getDoneFilePath();
@@ -57,21 +198,44 @@ public:
 
     // Undo and Redo
 public:
-    bool undo();   // Go backwards in the undo buffer without adding to it
-    bool redo();  // go forward in the undo buffor without adding to it
+    bool undo();   // Go backwards in the undo journal without adding to it
+    bool redo();  // go forward in the undo journal without adding to it
     bool undoPossible(); // Say if undo is possible or not
     bool redoPossible(); // Say if redo is possible or not
 
 protected:
-    QString getUndoDir(); // get the directory where we save undo stuff
-    QString getNewUndoNameDirAndPrefix(); // get a new prefix to be used for creating new undo files
-    void    cleanupUndoDir(); // Remove old files in the undo directory (not accessed for a while?)
-    void    saveToUndo();      // Adds the current changes to the undo buffer. Also moves the undo pointer to the last item (cementing whatever changes have been done with undoredo)
-    bool    checkNeedForUndo();
-    void    restoreFiles(QString);
+    // The undo journal keeps what changed instead of copies of the files, so an undo step costs
+    // about as much as the edit itself no matter how big done.txt has grown.
+    struct undoOp{
+        enum {insertLine, removeLine, replaceLine, appendFile} type;
+        int pos;                // Line in todo.txt
+        QString before;         // The line before the change (removeLine, replaceLine)
+        QString after;          // The line after the change (insertLine, replaceLine)
+        QString filename;       // The file that was appended to (appendFile)
+        qint64 offset;          // The size of that file before the append
+        vector<QString> lines;  // The lines that were appended
+    };
+    struct undoEntry{
+        vector<undoOp> ops;     // Applied in order on redo and in reverse on undo
+        qint64 bytes;
+    };
 
-    vector<QString> undoBuffer; // A buffer with base filenames for undos
-    int undoPointer = 0; // Pointer into the undo buffer for undo and redo. Generally should be 0
+    void    recordOp(undoOp op);       // Adds an operation to what the next commit will put in the journal
+    void    saveToUndo();              // Makes a journal entry of the recorded operations. Also drops whatever has been undone (cementing whatever changes have been done with undoredo)
+    void    recordDiff(vector<QString> &before,vector<QString> &after); // Records the change between two versions of todo.txt
+    void    applyUndo(undoEntry &entry,bool redo);
+    static void applyLineOp(const undoOp &op,bool redo,vector<QString> &doc); // Does or takes back a line op, finding the line by its text if it has moved
+    void    mergeFromDisk();           // Takes the todo.txt on disk and does the changes since the last commit again on top of it
+    void    takeFromDisk(vector<QString> &ondisk); // Makes the lines read from todo.txt the document. A change by someone else becomes an undo step
+    bool    reloadIfChanged();         // Reads todo.txt again if someone else has changed it. True if it did
+    void    unappend(const undoOp &op); // Takes the lines of an appendFile op out of the file again
+    void    trimUndo();                // Keeps the journal within SETTINGS_UNDO_BUDGET
+
+    vector<undoOp> pendingOps;  // Operations done since the last commit
+    deque<undoEntry> undoJournal;
+    qint64 undoBytes = 0;       // Approximate memory used by the journal
+    int undoPointer = 0; // Number of entries from the end of the journal that have been undone. Generally should be 0
+    bool loaded = false; // True once parse() has read the files the first time
 
     struct todoline{
         QString createdDate;
@@ -81,8 +245,29 @@ protected:
         QString text; // The rest of the text
     };
 
+    // Where the parts of a line are, found in one pass by tokenize(). The views point into the line
+    struct linetokens{
+        bool checked;
+        QStringView priority;   // Like in todoline, with the whitespace after them
+        QStringView closedDate;
+        QStringView createdDate;
+        QStringView text;
+        vector<QStringView> projects;   // Words that start with + or @
+        vector<QStringView> contexts;
+        vector<QStringView> thresholdProjects; // The +project of t:+project
+        vector<QStringView> thresholdContexts;
+        vector<int> thresholdDates;     // Every t: date, in julian days
+        int dueDate;            // The first due: date, INT_MAX if there is none
+        int urlStart;           // -1 if there is no URL
+        int urlLength;
+    };
+    linetokens scan; // Reused by parseTask(), so the lists keep their memory between lines
+
     static void String2Todo(QString &line,todoline &t);
     static QString Todo2String(todoline &t);
+    static void tokenize(QStringView line,linetokens &k,bool words); // Only the fields of todoline unless words is set
+    static void todoFromTokens(const linetokens &k,todoline &t);
+    static QString prettyPrint(todoline &tl);
 
 
 };